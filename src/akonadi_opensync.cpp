@@ -21,12 +21,11 @@
 */
 
 #include "akonadisink.h"
+#include "collectiontree.h"
 #include "datasink.h"
 
 #include <akonadi/control.h>
 #include <akonadi/collection.h>
-#include <akonadi/collectionfetchjob.h>
-#include <akonadi/collectionfetchscope.h>
 // #include <akonadi/collectionfilterproxymodel.h>
 #include <akonadi/mimetypechecker.h>
 
@@ -37,6 +36,8 @@
 #include <KUrl>
 
 #include <QCoreApplication>
+#include <QHash>
+#include <QSet>
 #include <QStringList>
 
 #include <opensync/opensync.h>
@@ -109,7 +110,7 @@ extern "C"
 		continue;
             }
 //             osync_objtype_sink_set_enabled(sink, true);
-// 	    mainSink->addSink(ds);
+	    mainSink->addSink(ds);
 	    sinkList.append(ds);
 	    osync_objtype_sink_set_available(sink, true);
         }
@@ -177,76 +178,88 @@ extern "C"
     application/x-vnd.akonadi.calendar.freebusy - this will be most probably ignored, so not checking for it
     */
 
-    static osync_bool testSupport(OSyncObjTypeSink *sink, OSyncPluginConfig *config, QString mimeType, OSyncError **error ) {
+    /**
+     * The configured resources, indexed so that each collection is matched in constant time.
+     */
+    struct ResourceIndex {
+        // by objtype, url and mimetype
+        QHash<QString, OSyncPluginResource*> resources;
+        // resources without a collection yet, by objtype
+        QHash<QString, QList<OSyncPluginResource*> > unset;
+        // objtypes with an enabled resource
+        QSet<QString> enabled;
+    };
+
+    static QString resourceKey( const QString &objType, const QString &url, const QString &mimeType ) {
+        return objType + '\n' + url + '\n' + mimeType;
+    }
 
-        kDebug();
+    static void indexResources( OSyncPluginConfig *config, ResourceIndex *index ) {
+        OSyncList *resList = osync_plugin_config_get_resources(config);
+        for ( OSyncList *r = resList; r; r = r->next ) {
+            OSyncPluginResource *myRes = (OSyncPluginResource*) r->data;
+
+            const QString myObjType = QString::fromLatin1( osync_plugin_resource_get_objtype(myRes) );
+            const QString myUrl = QString::fromLatin1( osync_plugin_resource_get_url(myRes) );
 
-        Akonadi::CollectionFetchScope scope;
-        scope.setIncludeUnsubscribed( true );
+            if ( myUrl == "default" )
+                index->unset[myObjType].append( myRes );
+            else
+                index->resources.insert( resourceKey( myObjType, myUrl, QString::fromLatin1( osync_plugin_resource_get_mime(myRes) ) ), myRes );
+            if ( osync_plugin_resource_is_enabled(myRes) )
+                index->enabled.insert( myObjType );
+        }
+    }
 
-        bool configured = false;
-        scope.setContentMimeTypes( QStringList() << mimeType );
+    static osync_bool testSupport(OSyncObjTypeSink *sink, ResourceIndex *index, OSyncPluginConfig *config,
+                                  const CollectionTree &tree, QString mimeType, OSyncError **error ) {
 
-        // fetch all akonadi collections for this mimetype
-        Akonadi::CollectionFetchJob *jobCol = new Akonadi::CollectionFetchJob(
-            Akonadi::Collection::root(), Akonadi::CollectionFetchJob::Recursive );
-        jobCol->setFetchScope(scope);
-        if ( !jobCol->exec() )
-            return false;
+        kDebug();
 
-        Akonadi::Collection::List colsList = jobCol->collections();
-        int col_count = colsList.count();
-        kDebug() << "found" << col_count << "collections";
-        bool enabled = false;
+        const QString objType = QString::fromLatin1( osync_objtype_sink_get_name(sink) );
+        const Akonadi::Collection::List colsList = tree.collections( mimeType );
+        kDebug() << "found" << colsList.count() << "collections for" << mimeType;
+        bool enabled = index->enabled.contains( objType );
 
         foreach ( const Akonadi::Collection &col, colsList ) {
-            kDebug() << "processing resource " << col.name() << col.contentMimeTypes();
-            kDebug() << "url                 " << col.name() << col.url().url();
-            configured = false;
-
-            OSyncList *resList = osync_plugin_config_get_resources(config);
-            for ( OSyncList *r = resList; r; r = r->next ) {
-                OSyncPluginResource *myRes = (OSyncPluginResource*) r->data;
-
-                const char *myObjType = osync_plugin_resource_get_objtype(myRes);
-                const char *myMimeType = osync_plugin_resource_get_mime(myRes);
-                const char *myUrl = osync_plugin_resource_get_url(myRes);
-
-                if ( !strcmp(myObjType, osync_objtype_sink_get_name(sink)) ) {
-                    if ( !strcmp(myUrl , "default") ) {
-                        osync_plugin_resource_set_name( myRes, toXml(col.name()).toLatin1().data() );
-                        osync_plugin_resource_set_url(myRes, col.url().url().toLatin1().data() );
-                        osync_plugin_resource_set_mime(myRes, mimeType.toLatin1().data() );
-                        configured = true;
-                    } else if ( !strcmp(myUrl, col.url().url().toLatin1().data()) && !strcmp(myMimeType, mimeType.toLatin1().data()) ) {
-                        kDebug() << "aleady configured" << myObjType;
-                        configured = true;
-                    }
-                    if (! enabled )
-                        enabled = osync_plugin_resource_is_enabled(myRes);
+            const QString url = col.url().url();
+            const QString key = resourceKey( objType, url, mimeType );
+
+            // resources set up by --configure take the first collection
+            const QList<OSyncPluginResource*> unset = index->unset.take( objType );
+            if ( !unset.isEmpty() ) {
+                foreach ( OSyncPluginResource *myRes, unset ) {
+                    osync_plugin_resource_set_name( myRes, toXml(col.name()).toLatin1().data() );
+                    osync_plugin_resource_set_url(myRes, url.toLatin1().data() );
+                    osync_plugin_resource_set_mime(myRes, mimeType.toLatin1().data() );
+                    index->resources.insert( key, myRes );
                 }
+                continue;
             }
 
-            if ( ! configured  ) {
-                OSyncPluginResource *newRes = create_resource(osync_objtype_sink_get_name(sink), error ) ;
-                osync_plugin_resource_set_name( newRes, toXml(col.name()).toLatin1() );
-                osync_plugin_resource_set_url(newRes, col.url().url().toLatin1());
-                osync_plugin_resource_set_mime(newRes, mimeType.toLatin1() );
-                if ( ! enabled  ) {
-                    osync_plugin_resource_enable( newRes, true );
-                    enabled = true;
-                }
-                else {
-                    osync_plugin_resource_enable( newRes, false );
-                }
+            if ( index->resources.contains( key ) ) {
+                kDebug() << "aleady configured" << objType << url;
+                continue;
+            }
 
-                osync_plugin_config_add_resource(config , newRes);
-                configured = true;
+            OSyncPluginResource *newRes = create_resource(osync_objtype_sink_get_name(sink), error ) ;
+            osync_plugin_resource_set_name( newRes, toXml(col.name()).toLatin1() );
+            osync_plugin_resource_set_url(newRes, url.toLatin1());
+            osync_plugin_resource_set_mime(newRes, mimeType.toLatin1() );
+            if ( ! enabled  ) {
+                osync_plugin_resource_enable( newRes, true );
+                enabled = true;
+                index->enabled.insert( objType );
+            }
+            else {
+                osync_plugin_resource_enable( newRes, false );
             }
 
+            osync_plugin_config_add_resource(config , newRes);
+            index->resources.insert( key, newRes );
         }
 
-        return configured;
+        return !colsList.isEmpty();
     }
 
     static osync_bool akonadi_discover(OSyncPluginInfo *info, void *userdata, OSyncError **error )
@@ -265,6 +278,19 @@ extern "C"
             return false;
         }
 
+        // one walk of the collection tree for all object types, cached for
+        // DiscoverCacheMaxAge minutes, 0 disables the cache
+        const char *maxAge = osync_plugin_config_get_advancedoption_value_by_name( config, "DiscoverCacheMaxAge" );
+        CollectionTree tree( CollectionTree::cacheFile( QString::fromLocal8Bit( osync_plugin_info_get_configdir(info) ) ),
+                             maxAge ? QString::fromLatin1( maxAge ).toInt() * 60 : int( CollectionTree::DefaultMaxAge ) );
+        tree.fetch( QStringList() << "application/x-vnd.kde.contactgroup"
+                                  << "application/x-vnd.akonadi.calendar.event"
+                                  << "application/x-vnd.akonadi.calendar.journal"
+                                  << "application/x-vnd.kde.notes"
+                                  << "application/x-vnd.akonadi.calendar.todo" );
+        ResourceIndex index;
+        indexResources( config, &index );
+
         OSyncList *sinks = osync_plugin_info_get_objtype_sinks(info);
         for ( OSyncList *s = sinks; s; s = s->next ) {
             OSyncObjTypeSink *sink = (OSyncObjTypeSink*) s->data;
@@ -276,26 +302,26 @@ extern "C"
                 *  for address book though "text/directory"
                 *  so we check here if there are contact groups
                 */
-                if ( ! testSupport(sink, config, "application/x-vnd.kde.contactgroup", error) )
+                if ( ! testSupport(sink, &index, config, tree, "application/x-vnd.kde.contactgroup", error) )
                     osync_objtype_sink_set_available(sink, false);
                 else
                     osync_objtype_sink_set_available(sink, true);
             }
             else if ( ! strcmp(myType,"event") ) {
-                if ( ! testSupport(sink, config, "application/x-vnd.akonadi.calendar.event", error) )
+                if ( ! testSupport(sink, &index, config, tree, "application/x-vnd.akonadi.calendar.event", error) )
                     osync_objtype_sink_set_available(sink, false);
                 else
                     osync_objtype_sink_set_available(sink, true);
             }
             else if ( ! strcmp(myType,"note") ) {
-                if ( ! testSupport(sink, config, "application/x-vnd.akonadi.calendar.journal", error)
-		  && ! testSupport(sink, config, "application/x-vnd.kde.notes", error) )
+                if ( ! testSupport(sink, &index, config, tree, "application/x-vnd.akonadi.calendar.journal", error)
+		  && ! testSupport(sink, &index, config, tree, "application/x-vnd.kde.notes", error) )
                     osync_objtype_sink_set_available(sink, false);
                 else
                     osync_objtype_sink_set_available(sink, true);
             }
             else if ( ! strcmp(myType,"todo") ) {
-                if ( ! testSupport(sink, config, "application/x-vnd.akonadi.calendar.todo", error) )
+                if ( ! testSupport(sink, &index, config, tree, "application/x-vnd.akonadi.calendar.todo", error) )
                     osync_objtype_sink_set_available(sink, false);
                 else
                     osync_objtype_sink_set_available(sink, true);
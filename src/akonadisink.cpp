@@ -18,6 +18,7 @@
 */
 
 #include "akonadisink.h"
+#include "datasink.h"
 
 #include <akonadi/control.h>
 
@@ -56,8 +57,22 @@ void AkonadiSink::connect()
     return;
   }
 
+  // all sessions connect at once, before anything is queued on them
+  foreach ( DataSink *sink, m_Sinks )
+    sink->openSession();
+
+  // the fetches run in the background until the sinks' getChanges() wait for them
+  foreach ( DataSink *sink, m_Sinks )
+    if ( sink->needsPrefetch() && sink->resolveCollections() )
+      sink->prefetch();
+
   success();
   osync_trace(TRACE_EXIT, "%s", __PRETTY_FUNCTION__);
 }
 
+void AkonadiSink::addSink( DataSink *sink )
+{
+  m_Sinks.append( sink );
+}
+
 #include "akonadisink.moc"
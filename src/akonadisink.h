@@ -22,8 +22,12 @@
 
 #include "sinkbase.h"
 
+#include <QList>
+
+class DataSink;
+
 /**
- * Main sink, does nothing but ensure Akonadi is running.
+ * Main sink, ensures Akonadi is running and starts the item fetches of the object type sinks.
  */
 class AkonadiSink : public SinkBase
 {
@@ -37,6 +41,13 @@ class AkonadiSink : public SinkBase
 
     void connect();
 
+    /**
+     * The object type sinks whose item fetches are started on connect().
+     */
+    void addSink( DataSink *sink );
+
+  private:
+    QList<DataSink*> m_Sinks;
 };
 
 #endif
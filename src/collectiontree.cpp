@@ -0,0 +1,185 @@
+/*
+    Copyright (c) 2026 Emanoil Kotsev <deloptes@yahoo.com>
+
+    $Id$
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#include "collectiontree.h"
+
+#include <akonadi/collectionfetchjob.h>
+#include <akonadi/collectionfetchscope.h>
+
+#include <KDebug>
+
+#include <QDataStream>
+#include <QDateTime>
+#include <QFile>
+
+using namespace Akonadi;
+
+static const quint32 CacheMagic = 0x414b4354; // "AKCT"
+static const quint32 CacheVersion = 1;
+
+// new sub collections of a known resource are only found by a full fetch, see m_MaxAge
+CollectionTree::CollectionTree( const QString &cacheFile, int maxAge ) :
+        m_CacheFile( cacheFile ),
+        m_MaxAge( maxAge )
+{
+}
+
+QString CollectionTree::cacheFile( const QString &configDir )
+{
+    return configDir + "/akonadi-discover.cache";
+}
+
+void CollectionTree::invalidate( const QString &cacheFile, const Collection::List &collections )
+{
+    QFile file( cacheFile );
+    if ( !file.open( QIODevice::ReadOnly ) )
+        return;
+
+    QDataStream stream( &file );
+    quint32 magic, version, count;
+    QDateTime created;
+    QStringList mimeTypes, signature;
+    stream >> magic >> version;
+    if ( magic != CacheMagic || version != CacheVersion )
+        return;
+    stream >> created >> mimeTypes >> signature >> count;
+
+    bool cached = false;
+    for ( quint32 i = 0; i < count && !cached && stream.status() == QDataStream::Ok; ++i ) {
+        qint64 id;
+        QString name;
+        QStringList contentMimeTypes;
+        stream >> id >> name >> contentMimeTypes;
+        foreach ( const Collection &col, collections )
+            cached = cached || ( col.id() == id );
+    }
+    file.close();
+
+    if ( cached ) {
+        kDebug() << "dropping cached collection tree" << cacheFile;
+        QFile::remove( cacheFile );
+    }
+}
+
+bool CollectionTree::fetch( const QStringList &mimeTypes )
+{
+    const QStringList signature = topLevelSignature();
+    if ( !signature.isEmpty() && load( mimeTypes, signature ) ) {
+        kDebug() << "using cached collection tree," << m_Collections.count() << "collections";
+        return true;
+    }
+
+    CollectionFetchScope scope;
+    scope.setIncludeUnsubscribed( true );
+    scope.setContentMimeTypes( mimeTypes );
+
+    // a single walk of the tree for all mimetypes
+    CollectionFetchJob *job = new CollectionFetchJob( Collection::root(), CollectionFetchJob::Recursive );
+    job->setFetchScope( scope );
+    if ( !job->exec() )
+        return false;
+
+    m_Collections = job->collections();
+    kDebug() << "fetched" << m_Collections.count() << "collections";
+
+    if ( !signature.isEmpty() )
+        save( mimeTypes, signature );
+    return true;
+}
+
+Collection::List CollectionTree::collections( const QString &mimeType ) const
+{
+    Collection::List cols;
+    foreach ( const Collection &col, m_Collections )
+        if ( col.contentMimeTypes().contains( mimeType ) )
+            cols.append( col );
+    return cols;
+}
+
+QStringList CollectionTree::topLevelSignature() const
+{
+    CollectionFetchScope scope;
+    scope.setIncludeUnsubscribed( true );
+
+    CollectionFetchJob *job = new CollectionFetchJob( Collection::root(), CollectionFetchJob::FirstLevel );
+    job->setFetchScope( scope );
+    if ( !job->exec() )
+        return QStringList();
+
+    QStringList signature;
+    foreach ( const Collection &col, job->collections() )
+        signature << QString::number( col.id() ) + ':' + col.resource() + ':' + col.name();
+    signature.sort();
+    return signature;
+}
+
+bool CollectionTree::load( const QStringList &mimeTypes, const QStringList &signature )
+{
+    QFile file( m_CacheFile );
+    if ( m_MaxAge <= 0 || !file.open( QIODevice::ReadOnly ) )
+        return false;
+
+    QDataStream stream( &file );
+    quint32 magic, version;
+    QDateTime created;
+    QStringList cachedMimeTypes, cachedSignature;
+    stream >> magic >> version;
+    if ( magic != CacheMagic || version != CacheVersion )
+        return false;
+    stream >> created >> cachedMimeTypes >> cachedSignature;
+    if ( cachedMimeTypes != mimeTypes || cachedSignature != signature
+         || created.secsTo( QDateTime::currentDateTime() ) > m_MaxAge )
+        return false;
+
+    Collection::List cols;
+    quint32 count;
+    stream >> count;
+    for ( quint32 i = 0; i < count && stream.status() == QDataStream::Ok; ++i ) {
+        qint64 id;
+        QString name;
+        QStringList contentMimeTypes;
+        stream >> id >> name >> contentMimeTypes;
+        Collection col( id );
+        col.setName( name );
+        col.setContentMimeTypes( contentMimeTypes );
+        cols.append( col );
+    }
+    if ( stream.status() != QDataStream::Ok )
+        return false;
+
+    m_Collections = cols;
+    return true;
+}
+
+void CollectionTree::save( const QStringList &mimeTypes, const QStringList &signature ) const
+{
+    QFile file( m_CacheFile );
+    if ( !file.open( QIODevice::WriteOnly | QIODevice::Truncate ) ) {
+        kDebug() << "unable to write" << m_CacheFile << file.errorString();
+        return;
+    }
+
+    QDataStream stream( &file );
+    stream << CacheMagic << CacheVersion << QDateTime::currentDateTime() << mimeTypes << signature;
+    stream << quint32( m_Collections.count() );
+    foreach ( const Collection &col, m_Collections )
+        stream << qint64( col.id() ) << col.name() << col.contentMimeTypes();
+}
@@ -0,0 +1,80 @@
+/*
+    Copyright (c) 2026 Emanoil Kotsev <deloptes@yahoo.com>
+
+    $Id$
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#ifndef COLLECTIONTREE_H
+#define COLLECTIONTREE_H
+
+#include <akonadi/collection.h>
+
+#include <QString>
+#include <QStringList>
+
+/**
+ * The Akonadi collections of all mimetypes we sync, fetched in one go.
+ *
+ * The tree is kept in a file between runs. It is used again as long as
+ * the top level collections, one per Akonadi resource, did not change
+ * and it is not older than maxAge, which takes a single flat fetch to check.
+ * Sinks drop the file when a fetch or commit against one of its collections fails.
+ */
+class CollectionTree
+{
+  public:
+    // in seconds
+    enum { DefaultMaxAge = 60 * 60 };
+
+    explicit CollectionTree( const QString &cacheFile, int maxAge = DefaultMaxAge );
+
+    /**
+     * Returns the name of the cache file in the plugin's configuration directory.
+     */
+    static QString cacheFile( const QString &configDir );
+
+    /**
+     * Removes the cache file if it holds one of the collections.
+     */
+    static void invalidate( const QString &cacheFile, const Akonadi::Collection::List &collections );
+
+    /**
+     * Loads the collections that can contain any of the mimetypes,
+     * from the cache if it is still valid. Returns false on error.
+     */
+    bool fetch( const QStringList &mimeTypes );
+
+    /**
+     * Returns the collections that can contain the given mimetype.
+     */
+    Akonadi::Collection::List collections( const QString &mimeType ) const;
+
+  private:
+    /**
+     * Returns the ids and names of the top level collections, empty on error.
+     */
+    QStringList topLevelSignature() const;
+    bool load( const QStringList &mimeTypes, const QStringList &signature );
+    void save( const QStringList &mimeTypes, const QStringList &signature ) const;
+
+    QString m_CacheFile;
+    int m_MaxAge;
+    Akonadi::Collection::List m_Collections;
+};
+
+#endif
@@ -0,0 +1,79 @@
+/*
+    Copyright (c) 2026 Emanoil Kotsev <deloptes@yahoo.com>
+
+    $Id$
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+
+#include "commitscheduler.h"
+
+#include <QtGlobal>
+
+CommitScheduler::CommitScheduler( int batchSize, int window ) :
+        m_BatchSize( qMax( batchSize, 1 ) ),
+        m_Window( qMax( window, 1 ) ),
+        m_InFlight( 0 )
+{
+}
+
+void CommitScheduler::setLimits( int batchSize, int window )
+{
+    m_BatchSize = qMax( batchSize, 1 );
+    m_Window = qMax( window, 1 );
+}
+
+int CommitScheduler::batchSize() const
+{
+    return m_BatchSize;
+}
+
+int CommitScheduler::window() const
+{
+    return m_Window;
+}
+
+bool CommitScheduler::canStart() const
+{
+    return m_InFlight < m_Window;
+}
+
+int CommitScheduler::nextChunkSize( int queued, bool flush ) const
+{
+    if ( !canStart() || queued <= 0 )
+        return 0;
+    if ( queued >= m_BatchSize )
+        return m_BatchSize;
+    // a partial chunk may still be filled up by the next commit()
+    return flush ? queued : 0;
+}
+
+void CommitScheduler::chunkStarted()
+{
+    ++m_InFlight;
+}
+
+void CommitScheduler::chunkFinished()
+{
+    Q_ASSERT( m_InFlight > 0 );
+    --m_InFlight;
+}
+
+int CommitScheduler::inFlight() const
+{
+    return m_InFlight;
+}
@@ -0,0 +1,61 @@
+/*
+    Copyright (c) 2026 Emanoil Kotsev <deloptes@yahoo.com>
+
+    $Id$
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+
+#ifndef COMMITSCHEDULER_H
+#define COMMITSCHEDULER_H
+
+/**
+ * Decides when queued changes are written to akonadi: in chunks of the batch
+ * size, with at most window chunks in flight at the same time. A partial
+ * chunk is only started when the queue is flushed at committed_all.
+ */
+class CommitScheduler
+{
+  public:
+    CommitScheduler( int batchSize, int window );
+
+    void setLimits( int batchSize, int window );
+    int batchSize() const;
+    int window() const;
+
+    /**
+     * Returns true if another chunk may be started.
+     */
+    bool canStart() const;
+
+    /**
+     * Returns the number of queued changes that go into the next chunk,
+     * 0 if none should be started now.
+     */
+    int nextChunkSize( int queued, bool flush ) const;
+
+    void chunkStarted();
+    void chunkFinished();
+    int inFlight() const;
+
+  private:
+    int m_BatchSize;
+    int m_Window;
+    int m_InFlight;
+};
+
+#endif
@@ -0,0 +1,318 @@
+/*
+    Copyright (c) 2026 Emanoil Kotsev <deloptes@yahoo.com>
+
+    $Id$
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#include "conversioncache.h"
+
+#include <KDebug>
+
+#include <QDataStream>
+#include <QList>
+#include <QMap>
+
+#include <opensync/opensync.h>
+
+using namespace Akonadi;
+
+static const quint32 FileMagic = 0x414b4343; // "AKCC"
+static const quint32 FileVersion = 2;
+static const quint32 RecordMagic = 0x52454331; // "REC1"
+// marks a record as used again, the plugin runs in a new process for every sync
+static const quint32 TouchMagic = 0x54434831; // "TCH1"
+
+ConversionCache::ConversionCache( const QString &fileName, qint64 maxSize, bool compress ) :
+        m_File( fileName ),
+        m_MaxSize( maxSize ),
+        m_Compress( compress ),
+        m_Map( 0 ),
+        m_MapSize( 0 ),
+        m_Clock( 0 ),
+        m_LiveBytes( 0 ),
+        m_Hits( 0 ),
+        m_Misses( 0 )
+{
+    if ( !load() )
+        kDebug() << "conversion cache" << fileName << "not available";
+}
+
+ConversionCache::~ConversionCache()
+{
+    writeTouches();
+    unmap();
+    m_File.close();
+}
+
+QString ConversionCache::key( Item::Id id, const QString &format )
+{
+    return QString::number( id ) + ':' + format;
+}
+
+bool ConversionCache::load()
+{
+    if ( !m_File.open( QIODevice::ReadWrite ) )
+        return false;
+
+    if ( m_File.size() == 0 ) {
+        QDataStream stream( &m_File );
+        stream << FileMagic << FileVersion;
+    }
+    if ( !map() )
+        return false;
+
+    QByteArray raw = QByteArray::fromRawData( reinterpret_cast<const char*>( m_Map ), m_MapSize );
+    QDataStream stream( raw );
+    quint32 magic, version;
+    stream >> magic >> version;
+    if ( stream.status() != QDataStream::Ok || magic != FileMagic || version != FileVersion ) {
+        kDebug() << "discarding conversion cache of unknown format";
+        unmap();
+        m_File.resize( 0 );
+        QDataStream out( &m_File );
+        out << FileMagic << FileVersion;
+        return map();
+    }
+
+    // later records for the same key replace earlier ones, and records and
+    // touches in file order are the order of use
+    qint64 good = stream.device()->pos();
+    while ( !stream.atEnd() ) {
+        quint32 recordMagic, size;
+        qint64 id;
+        qint32 revision;
+        quint8 compressed;
+        QString format;
+        stream >> recordMagic >> id;
+        if ( stream.status() == QDataStream::Ok && recordMagic == TouchMagic ) {
+            stream >> format;
+            if ( stream.status() != QDataStream::Ok )
+                break;
+            QHash<QString, Entry>::iterator it = m_Index.find( key( id, format ) );
+            if ( it != m_Index.end() )
+                it.value().lastUse = ++m_Clock;
+            good = stream.device()->pos();
+            continue;
+        }
+        stream >> revision >> compressed >> format >> size;
+        if ( stream.status() != QDataStream::Ok || recordMagic != RecordMagic )
+            break;
+
+        Entry entry;
+        entry.revision = revision;
+        entry.offset = stream.device()->pos();
+        entry.size = size;
+        entry.compressed = compressed;
+        entry.lastUse = ++m_Clock;
+        if ( stream.skipRawData( size ) != (int) size )
+            break;
+
+        const QString k = key( id, format );
+        if ( m_Index.contains( k ) )
+            m_LiveBytes -= m_Index.value( k ).size;
+        m_Index.insert( k, entry );
+        m_LiveBytes += size;
+        good = stream.device()->pos();
+    }
+
+    // cut off what an interrupted write left behind
+    if ( good < m_MapSize ) {
+        kDebug() << "truncating conversion cache at" << good;
+        unmap();
+        m_File.resize( good );
+        if ( !map() )
+            return false;
+    }
+
+    kDebug() << m_File.fileName() << ":" << m_Index.count() << "entries," << m_MapSize << "bytes";
+    return true;
+}
+
+bool ConversionCache::map()
+{
+    unmap();
+    m_MapSize = m_File.size();
+    m_Map = m_File.map( 0, m_MapSize );
+    if ( !m_Map ) {
+        m_MapSize = 0;
+        return false;
+    }
+    return true;
+}
+
+void ConversionCache::unmap()
+{
+    if ( m_Map )
+        m_File.unmap( m_Map );
+    m_Map = 0;
+    m_MapSize = 0;
+}
+
+bool ConversionCache::lookup( Item::Id id, int revision, const QString &format, QByteArray *data )
+{
+    QHash<QString, Entry>::iterator it = m_Index.find( key( id, format ) );
+    if ( it == m_Index.end() || it.value().revision != revision ) {
+        ++m_Misses;
+        return false;
+    }
+
+    // records appended since the last map() are not mapped yet
+    if ( it.value().offset + it.value().size > m_MapSize && !map() ) {
+        ++m_Misses;
+        return false;
+    }
+
+    const char *raw = reinterpret_cast<const char*>( m_Map ) + it.value().offset;
+    if ( it.value().compressed )
+        *data = qUncompress( reinterpret_cast<const uchar*>( raw ), it.value().size );
+    else
+        *data = QByteArray( raw, it.value().size );
+    if ( data->isEmpty() ) {
+        ++m_Misses;
+        return false;
+    }
+
+    it.value().lastUse = ++m_Clock;
+    m_Touched.append( qMakePair( id, format ) );
+    ++m_Hits;
+    return true;
+}
+
+void ConversionCache::writeTouches()
+{
+    if ( m_Touched.isEmpty() || !m_File.isOpen() )
+        return;
+
+    // one write at the end instead of one per hit
+    QByteArray touches;
+    QDataStream stream( &touches, QIODevice::WriteOnly );
+    typedef QPair<Akonadi::Item::Id, QString> Touch;
+    foreach ( const Touch &touch, m_Touched )
+        stream << TouchMagic << qint64( touch.first ) << touch.second;
+    m_Touched.clear();
+
+    m_File.seek( m_File.size() );
+    if ( m_File.write( touches ) != touches.size() )
+        kDebug() << "unable to write conversion cache:" << m_File.errorString();
+}
+
+void ConversionCache::insert( Item::Id id, int revision, const QString &format, const QByteArray &data )
+{
+    if ( !m_File.isOpen() )
+        return;
+
+    Entry entry;
+    if ( !append( id, revision, format, data, &entry ) )
+        return;
+
+    const QString k = key( id, format );
+    if ( m_Index.contains( k ) )
+        m_LiveBytes -= m_Index.value( k ).size;
+    m_Index.insert( k, entry );
+    m_LiveBytes += entry.size;
+
+    if ( m_File.size() > m_MaxSize )
+        compact();
+}
+
+bool ConversionCache::append( Item::Id id, int revision, const QString &format, const QByteArray &data, Entry *entry )
+{
+    const QByteArray stored = m_Compress ? qCompress( data ) : data;
+
+    m_File.seek( m_File.size() );
+    QDataStream stream( &m_File );
+    stream << RecordMagic << qint64( id ) << qint32( revision ) << quint8( m_Compress ) << format
+           << quint32( stored.size() );
+    entry->offset = m_File.pos();
+    if ( stream.writeRawData( stored.constData(), stored.size() ) != stored.size() ) {
+        kDebug() << "unable to write conversion cache:" << m_File.errorString();
+        return false;
+    }
+
+    entry->revision = revision;
+    entry->size = stored.size();
+    entry->compressed = m_Compress;
+    entry->lastUse = ++m_Clock;
+    return true;
+}
+
+void ConversionCache::compact()
+{
+    kDebug() << "compacting conversion cache," << m_File.size() << "bytes," << m_LiveBytes << "live";
+    if ( !map() )
+        return;
+
+    // most recently used first, keep them until half of the maximum size is used
+    QMap<quint64, QString> byUse;
+    for ( QHash<QString, Entry>::const_iterator it = m_Index.constBegin(); it != m_Index.constEnd(); ++it )
+        byUse.insert( it.value().lastUse, it.key() );
+
+    QList<QString> keep;
+    qint64 bytes = 0;
+    QMap<quint64, QString>::const_iterator it = byUse.constEnd();
+    while ( it != byUse.constBegin() ) {
+        --it;
+        const int size = m_Index.value( it.value() ).size;
+        if ( bytes + size > m_MaxSize / 2 )
+            break;
+        bytes += size;
+        keep.prepend( it.value() );
+    }
+
+    QFile out( m_File.fileName() + ".new" );
+    if ( !out.open( QIODevice::WriteOnly | QIODevice::Truncate ) )
+        return;
+    QDataStream stream( &out );
+    stream << FileMagic << FileVersion;
+    // least recently used first, so that load() restores the order
+    foreach ( const QString &k, keep ) {
+        const Entry &entry = m_Index[k];
+        const Item::Id id = k.section( ':', 0, 0 ).toLongLong();
+        const QString format = k.section( ':', 1 );
+        stream << RecordMagic << qint64( id ) << qint32( entry.revision ) << quint8( entry.compressed ) << format
+               << quint32( entry.size );
+        stream.writeRawData( reinterpret_cast<const char*>( m_Map ) + entry.offset, entry.size );
+    }
+    out.close();
+
+    // the order of use is in the rewritten file already
+    m_Touched.clear();
+    unmap();
+    m_File.close();
+    QFile::remove( m_File.fileName() );
+    QFile::rename( out.fileName(), m_File.fileName() );
+
+    m_Index.clear();
+    m_LiveBytes = 0;
+    m_Clock = 0;
+    load();
+}
+
+void ConversionCache::reportStatistics( const QString &name ) const
+{
+    kDebug() << name << "conversion cache:" << m_Hits << "hits," << m_Misses << "misses,"
+             << m_Index.count() << "entries," << m_LiveBytes << "of" << m_MaxSize << "bytes used";
+    osync_trace( TRACE_INTERNAL, "%s: conversion cache %d hits, %d misses, %d entries, %lld bytes",
+                 name.toLatin1().data(), m_Hits, m_Misses, m_Index.count(), (long long) m_LiveBytes );
+}
+
+void ConversionCache::resetStatistics()
+{
+    m_Hits = 0;
+    m_Misses = 0;
+}
@@ -0,0 +1,94 @@
+/*
+    Copyright (c) 2026 Emanoil Kotsev <deloptes@yahoo.com>
+
+    $Id$
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#ifndef CONVERSIONCACHE_H
+#define CONVERSIONCACHE_H
+
+#include <QByteArray>
+#include <QFile>
+#include <QHash>
+#include <QList>
+#include <QPair>
+#include <QString>
+
+#include <akonadi/item.h>
+
+/**
+ * On-disk cache of converted payloads, keyed by item id, revision and objformat.
+ *
+ * Records are appended to a single memory-mapped file. Hits are appended as
+ * touches when the cache is closed, so the order of use survives the process.
+ * When the file grows beyond the maximum size, the least recently used
+ * entries are dropped and the file is rewritten.
+ */
+class ConversionCache
+{
+  public:
+    ConversionCache( const QString &fileName, qint64 maxSize, bool compress );
+    ~ConversionCache();
+
+    /**
+     * Returns true and fills data if the item is cached in the given revision and format.
+     */
+    bool lookup( Akonadi::Item::Id id, int revision, const QString &format, QByteArray *data );
+
+    void insert( Akonadi::Item::Id id, int revision, const QString &format, const QByteArray &data );
+
+    /**
+     * Writes hits, misses and size to the debug output and trace.
+     */
+    void reportStatistics( const QString &name ) const;
+    void resetStatistics();
+
+  private:
+    struct Entry {
+        int revision;
+        qint64 offset;
+        int size;
+        bool compressed;
+        quint64 lastUse;
+    };
+
+    static QString key( Akonadi::Item::Id id, const QString &format );
+    bool load();
+    bool map();
+    void unmap();
+    bool append( Akonadi::Item::Id id, int revision, const QString &format, const QByteArray &data, Entry *entry );
+    void compact();
+    /**
+     * Appends the hits since the last call, so load() knows their order of use.
+     */
+    void writeTouches();
+
+    QFile m_File;
+    qint64 m_MaxSize;
+    bool m_Compress;
+    uchar *m_Map;
+    qint64 m_MapSize;
+    QHash<QString, Entry> m_Index;
+    QList< QPair<Akonadi::Item::Id, QString> > m_Touched;
+    quint64 m_Clock;
+    qint64 m_LiveBytes;
+    int m_Hits;
+    int m_Misses;
+};
+
+#endif
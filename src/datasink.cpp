@@ -21,42 +21,88 @@
 */
 
 #include "datasink.h"
+#include "collectiontree.h"
+#include "conversioncache.h"
+#include "syncmetrics.h"
+#include "synctrace.h"
+#include "timeoutbudget.h"
 
+#include <akonadi/cachepolicy.h>
 #include <akonadi/collectionfetchjob.h>
 #include <akonadi/collectionfetchscope.h>
+#include <akonadi/collectionstatistics.h>
+#include <akonadi/collectionstatisticsjob.h>
 #include <akonadi/itemdeletejob.h>
 #include <akonadi/itemmodifyjob.h>
 #include <akonadi/itemcreatejob.h>
 #include <akonadi/itemfetchscope.h>
 #include <akonadi/mimetypechecker.h>
+#include <akonadi/servermanager.h>
+#include <akonadi/session.h>
+#include <akonadi/transactionsequence.h>
 
+#include <KDebug>
+#include <KLocale>
 
-// calendar includes
-#include <kcal/incidence.h>
-#include <kcal/icalformat.h>
+#include <QDateTime>
+#include <QEventLoop>
+#include <QFile>
 
-// contact includes
-#include <kabc/addressee.h>
-#include <kabc/vcardconverter.h>
-#include <kabc/vcardparser.h>
-#include <kabc/vcardformat.h>
+#include <glib.h>
 
-// TODO
-// notes, todos, journals & includes are done by icalformat
-// I am not quite sure about it, but I think
-// this needs to be checked when working on todos and notes
+using namespace Akonadi;
 
-#include <KDebug>
-#include <KLocale>
+// number of items whose payload is requested by a single fetch job
+static const int PayloadFetchBatchSize = 100;
+// number of changes written to akonadi within one transaction
+static const int DefaultCommitBatchSize = 200;
+// number of commit transactions running at the same time
+static const int DefaultCommitWindow = 16;
+// getChanges() of unchanged collections skipped in a row before a full scan
+static const int DefaultSkipUnchangedMaxSyncs = 10;
+// and the longest time between two full scans, in seconds
+static const int SkipUnchangedMaxAge = 24 * 60 * 60;
+// the conversion cache keeps the payload fingerprints next to the conversions
+static const char *FingerprintFormat = "fingerprint";
+
+static int advancedOption ( OSyncPluginConfig *config, const char *name, int defaultValue )
+{
+    const char *value = osync_plugin_config_get_advancedoption_value_by_name ( config, name );
+    if ( !value )
+        return defaultValue;
 
-using namespace Akonadi;
+    bool ok = false;
+    int i = QString::fromLatin1( value ).toInt( &ok );
+    return ( ok && i > 0 ) ? i : defaultValue;
+}
 
-typedef boost::shared_ptr<KCal::Incidence> IncidencePtr;
+static QString advancedOptionString ( OSyncPluginConfig *config, const char *name )
+{
+    const char *value = osync_plugin_config_get_advancedoption_value_by_name ( config, name );
+    return value ? QString::fromLatin1( value ).trimmed() : QString();
+}
 
 DataSink::DataSink ( int type ) :
-        SinkBase ( GetChanges | Commit | SyncDone ),
+        SinkBase ( Connect | GetChanges | Commit | CommittedAll | SyncDone ),
         m_Format("default"),
-        m_Url("default")
+        m_RemoteIdIndexValid(false),
+        m_Scheduler(DefaultCommitBatchSize, DefaultCommitWindow),
+        m_Flushing(false),
+        m_Dispatching(false),
+        m_CommitFailed(false),
+        m_Cache(0),
+        m_ReceivedItems(0),
+        m_SkippedItems(0),
+        m_SkipUnchanged(false),
+        m_SkipUnchangedMaxSyncs(DefaultSkipUnchangedMaxSyncs),
+        m_SkippedSyncs(0),
+        m_Skipping(false),
+        m_CommittedChanges(0),
+        m_PrimaryCollection(-1),
+        m_Session(0),
+        m_Prefetching(false),
+        m_CollectionsResolved(false),
+        m_Budget(0)
 {
     m_type = type;
 }
@@ -64,6 +110,8 @@ DataSink::DataSink ( int type ) :
 DataSink::~DataSink()
 {
     kDebug() << "DataSink destructor called"; // TODO still needed
+    delete m_Cache;
+    delete m_Budget;
 }
 
 bool DataSink::initialize ( OSyncPlugin * plugin, OSyncPluginInfo * info, OSyncObjTypeSink *sink, OSyncError ** error )
@@ -82,13 +130,33 @@ bool DataSink::initialize ( OSyncPlugin * plugin, OSyncPluginInfo * info, OSyncO
         return false;
     }
 
+    m_Scheduler.setLimits( advancedOption( config, "CommitBatchSize", DefaultCommitBatchSize ),
+                           advancedOption( config, "CommitWindow", DefaultCommitWindow ) );
+    m_SkipUnchanged = advancedOption( config, "SkipUnchangedCollections", 0 ) != 0;
+    m_SkipUnchangedMaxSyncs = advancedOption( config, "SkipUnchangedMaxSyncs", DefaultSkipUnchangedMaxSyncs );
+    kDebug() << "commit batch size" << m_Scheduler.batchSize() << "window" << m_Scheduler.window();
+
 // require enabled ressource
     OSyncPluginResource *resource = osync_plugin_config_find_active_resource ( config, osync_objtype_sink_get_name ( sink ) );
     if ( ! resource || ! osync_plugin_resource_is_enabled(resource) )
         return false;
 
-// get url
-    m_Url = osync_plugin_resource_get_url ( resource );
+// get urls, new items go to the active resource
+    m_Urls.clear();
+    m_Urls << QString::fromLatin1( osync_plugin_resource_get_url ( resource ) );
+    // opt-in, the other enabled resources of our objtype are synced as well
+    const bool allResources = advancedOption( config, "SyncAllResources", 0 ) != 0;
+    OSyncList *resList = allResources ? osync_plugin_config_get_resources ( config ) : 0;
+    for ( OSyncList *r = resList; r; r = r->next ) {
+        OSyncPluginResource *res = ( OSyncPluginResource* ) r->data;
+        if ( !osync_plugin_resource_is_enabled ( res ) || strcmp ( osync_plugin_resource_get_objtype ( res ), m_Name.toLatin1().data() ) )
+            continue;
+        const QString url = QString::fromLatin1( osync_plugin_resource_get_url ( res ) );
+        if ( !url.isEmpty() && !m_Urls.contains( url ) )
+            m_Urls << url;
+    }
+    m_PrimaryCollection = Collection::fromUrl ( KUrl ( m_Urls.first() ) ).id();
+    kDebug() << "syncing" << m_Urls;
 
 // set format    
     OSyncList *objfrmtList = osync_plugin_resource_get_objformat_sinks ( resource );
@@ -153,25 +221,80 @@ bool DataSink::initialize ( OSyncPlugin * plugin, OSyncPluginInfo * info, OSyncO
     }
 
     osync_list_free(objfrmtList);
+    m_MimeTypeChecker.setWantedMimeTypes( QStringList() << m_MimeType );
+    m_Serializer.setFormat( m_MimeType, m_Format );
+
+    // per objtype, e.g. contact.MaxInlineSize, for peers that can not store large binaries
+    m_Serializer.setMaxInlineSize( advancedOption( config, ( m_Name + ".MaxInlineSize" ).toLatin1().data(), 0 ) );
+    foreach ( const QString &part, advancedOptionString( config, ( m_Name + ".PayloadParts" ).toLatin1().data() )
+                                   .split( ',', QString::SkipEmptyParts ) )
+        m_PayloadParts << part.trimmed().toLatin1();
+    // conversions of another policy must not come from the cache
+    m_CacheFormat = m_Format;
+    if ( m_Serializer.maxInlineSize() > 0 )
+        m_CacheFormat += "-max" + QString::number( m_Serializer.maxInlineSize() );
+    foreach ( const QByteArray &part, m_PayloadParts )
+        m_CacheFormat += '-' + QString::fromLatin1( part );
+
+    // the binary trace is written there when a sink fails, and at the end of each
+    // sync with AKONADI_SYNC_TRACE set. A value other than 1 names another file.
+    const QByteArray traceFile = qgetenv( "AKONADI_SYNC_TRACE" );
+    if ( !traceFile.isEmpty() && traceFile != "1" )
+        SyncTrace::setDumpFile( QFile::decodeName( traceFile ) );
+    else
+        SyncTrace::setDumpFile( QString::fromLocal8Bit( osync_plugin_info_get_configdir( info ) ) + "/akonadi-sync-trace.txt" );
+
+    if ( advancedOption( config, "SyncMetrics", 0 ) != 0 )
+        setMetrics( new SyncMetrics( QString::fromLocal8Bit( osync_plugin_info_get_configdir( info ) )
+                                     + "/akonadi-sync-metrics.json" ) );
+
+    // size in MB, 0 disables the cache
+    const int cacheSize = advancedOption( config, "ConversionCacheSize", 0 );
+    if ( cacheSize > 0 ) {
+        const QString fileName = QString::fromLocal8Bit( osync_plugin_info_get_configdir( info ) )
+                                 + "/akonadi-" + m_Name + "-conversion.cache";
+        m_Cache = new ConversionCache( fileName, qint64( cacheSize ) * 1024 * 1024,
+                                       advancedOption( config, "ConversionCacheCompress", 0 ) != 0 );
+    }
 // this adds preffered to the resource configuration if not set
     if ( ! preferred || strcmp(preferred,m_Format.toLatin1().data() ) )
         osync_plugin_resource_set_preferred_format( resource, m_Format.toLatin1().data() );
 
     kDebug() << "Has objformat: " << m_Format;
 
+    m_CollectionTreeCache = CollectionTree::cacheFile( QString::fromLocal8Bit( osync_plugin_info_get_configdir( info ) ) );
+
+    // wrapSink() takes the timeouts from here
+    m_Budget = new TimeoutBudget( QString::fromLocal8Bit( osync_plugin_info_get_configdir( info ) )
+                                  + "/akonadi-" + m_Name + "-timeouts.ini" );
+    if ( ServerManager::isRunning() ) {
+        int items = 0;
+        foreach ( const Collection &col, collections() ) {
+            // before connect(), our own session is not open yet
+            CollectionStatisticsJob *job = new CollectionStatisticsJob ( col );
+            if ( job->exec() )
+                items += job->statistics().count();
+        }
+        m_Budget->expectItems( SyncMetrics::GetChanges, items );
+    }
+
     wrapSink ( sink );
+    kDebug() << "timeouts: get_changes" << timeout( SyncMetrics::GetChanges ) << "s, committed_all" << timeout( SyncMetrics::CommitAll ) << "s";
 //     osync_objtype_sink_set_userdata ( sink, this );
 
     osync_objtype_sink_enable_hashtable ( sink , true );
+    // keeps the collection state of the last sync, see unchangedSinceLastSync()
+    osync_objtype_sink_enable_state_db ( sink, true );
 
     return true;
 }
 
 Akonadi::Collection DataSink::collection() const
 {
-    kDebug();
+    if ( m_CollectionsResolved )
+        return m_Collections.first();
 
-    const KUrl url = KUrl ( m_Url );
+    const KUrl url = KUrl ( m_Urls.value( 0 ) );
 
     if ( url.isEmpty() )
     {
@@ -182,11 +305,141 @@ Akonadi::Collection DataSink::collection() const
     return Collection::fromUrl ( url );
 }
 
+Akonadi::Collection::List DataSink::collections() const
+{
+    if ( m_CollectionsResolved )
+        return m_Collections;
+
+    Collection::List cols;
+    foreach ( const QString &url, m_Urls ) {
+        const Collection col = Collection::fromUrl ( KUrl ( url ) );
+        if ( col.isValid() )
+            cols.append( col );
+    }
+    return cols;
+}
+
+bool DataSink::resolveCollections()
+{
+    if ( m_CollectionsResolved )
+        return true;
+
+    const Collection::List wanted = collections();
+    if ( wanted.isEmpty() )
+        return false;
+
+    // content mimetypes and cache policy come along with the collections
+    Collection::List fetched;
+    CollectionFetchJob *job = new CollectionFetchJob ( wanted, CollectionFetchJob::Base, m_Session );
+    if ( job->exec() ) {
+        fetched = job->collections();
+    } else {
+        // the job fails as a whole if one of them is gone, find out which
+        kDebug() << "unable to fetch collections:" << job->errorText();
+        foreach ( const Collection &col, wanted ) {
+            CollectionFetchJob *single = new CollectionFetchJob ( col, CollectionFetchJob::Base, m_Session );
+            if ( single->exec() )
+                fetched += single->collections();
+        }
+    }
+
+    QHash<Collection::Id, Collection> found;
+    foreach ( const Collection &col, fetched )
+        found.insert( col.id(), col );
+
+    Collection::List resolved;
+    m_UnavailablePrefixes.clear();
+    foreach ( const Collection &col, wanted ) {
+        const Collection c = found.value( col.id() );
+        QString problem;
+        if ( !c.isValid() )
+            problem = "does not exist";
+        else if ( !m_MimeTypeChecker.isWantedCollection( c ) )
+            problem = "can not contain " + m_MimeType;
+
+        if ( problem.isEmpty() ) {
+            kDebug() << "collection" << c.id() << c.name() << c.contentMimeTypes() << "cache policy inherited:" << c.cachePolicy().inheritFromParent();
+            resolved.append( c );
+        } else if ( col.id() == m_PrimaryCollection ) {
+            // new items have nowhere to go
+            kDebug() << "collection" << col.id() << problem;
+            return false;
+        } else {
+            // its items are not fetched, they must not be reported as deleted
+            kDebug() << "collection" << col.id() << problem << ", not syncing it";
+            m_UnavailablePrefixes << uid( col.id(), QString() );
+        }
+    }
+
+    m_Collections = resolved;
+    m_CollectionsResolved = true;
+    return true;
+}
+
+void DataSink::invalidateCollections()
+{
+    kDebug() << "collections of" << m_Name << "are resolved again on next use";
+    m_CollectionsResolved = false;
+    // discover must not offer them from its cache either
+    CollectionTree::invalidate( m_CollectionTreeCache, m_Collections );
+}
+
+void DataSink::openSession()
+{
+    if ( m_Session )
+        return;
+
+    // our own session, so that the jobs of the sinks do not queue up behind each other
+    m_Session = new Session ( "akonadi-sync-" + m_Name.toLatin1(), this );
+
+    // the connection is set up by the first job, let the root fetch pay for it
+    // while the other sinks are still being connected
+    CollectionFetchJob *job = new CollectionFetchJob ( Collection::root(), CollectionFetchJob::Base, m_Session );
+    job->fetchScope().setIncludeUnsubscribed( true );
+
+    // the same for the sessions the further collections are fetched on
+    foreach ( const QString &url, m_Urls ) {
+        const Collection col = Collection::fromUrl ( KUrl ( url ) );
+        if ( !col.isValid() || col.id() == m_PrimaryCollection )
+            continue;
+        job = new CollectionFetchJob ( col, CollectionFetchJob::Base, fetchSession( col.id() ) );
+        job->fetchScope().setIncludeUnsubscribed( true );
+    }
+}
+
+void DataSink::connect()
+{
+    // usually opened by the main sink's connect() already
+    openSession();
+    if ( !resolveCollections() ) {
+        error( OSYNC_ERROR_MISCONFIGURATION, "Unable to resolve the collection of " + m_Name + '.' );
+        return;
+    }
+
+    // the engine took the failed changes of the last sync for written, see finishCommit()
+    m_CommitFailed = false;
+    if ( !state( "commitfailed" ).isEmpty() ) {
+        kDebug() << "changes of the last sync could not be written, requesting a slow sync";
+        osync_trace ( TRACE_INTERNAL, "%s: last commit failed, slow sync", m_Name.toLatin1().data() );
+        osync_context_report_slowsync ( context() );
+    }
+    success();
+}
+
+QString DataSink::uid( Collection::Id collection, const QString &remoteId ) const
+{
+    // keeps the uids of the first collection stable when more are enabled later
+    if ( collection == m_PrimaryCollection )
+        return remoteId;
+    return QString::number( collection ) + '/' + remoteId;
+}
+
+
 
 void DataSink::getChanges()
 {
     kDebug();
-    kDebug() << " DataSink::getChanges() called";
+    SYNC_TRACE( 1, GetChangesStarted, getSlowSink(), 0 );
     OSyncError *oerror = 0;
 
     OSyncHashTable *hashtable = osync_objtype_sink_get_hashtable ( sink() );
@@ -211,10 +464,22 @@ void DataSink::getChanges()
         }
     }
 
-        Akonadi::Collection col = collection() ;
-	
-// 	col.setContentMimeTypes( QStringList() << getMimeWithFormat(format) );
-        if ( !col.isValid() )
+    // the index is rebuilt from the items we are going to receive below
+    m_RemoteIdIndex.clear();
+    m_RemoteIdIndexValid = false;
+    m_ChangedItems.clear();
+    m_ChangedUids.clear();
+    m_CommitTargets.clear();
+    m_ReceivedItems = 0;
+    m_SkippedItems = 0;
+    m_Serializer.resetStatistics();
+    m_CommittedChanges = 0;
+    m_CommitErrors.clear();
+    m_CollectionState.clear();
+    m_Skipping = false;
+
+        // usually resolved in connect() already
+        if ( !resolveCollections() )
         {
             kDebug() << "No collection";
             osync_trace ( TRACE_EXIT_ERROR, "%s: %s", __PRETTY_FUNCTION__, osync_error_print ( &oerror ) );
@@ -222,60 +487,258 @@ void DataSink::getChanges()
             return;
         }
 
-        ItemFetchJob *job = new ItemFetchJob ( col );
-        job->fetchScope().fetchFullPayload();
-        kDebug() << "Fetched full payload";
+        if ( m_SkipUnchanged && !getSlowSink() && unchangedSinceLastSync() ) {
+            kDebug() << "collection unchanged since last sync, skipping item fetch";
+            osync_trace ( TRACE_INTERNAL, "%s: collection unchanged", m_Name.toLatin1().data() );
+            m_Skipping = true;
+            discardPrefetch();
+            reportAllUnmodified();
+            success();
+            return;
+        }
 
-        QObject::connect ( job, SIGNAL ( itemsReceived ( const Akonadi::Item::List & ) ), this, SLOT ( slotItemsReceived ( const Akonadi::Item::List & ) ) );
-        QObject::connect ( job, SIGNAL ( result ( KJob * ) ), this, SLOT ( slotGetChangesFinished ( KJob * ) ) );
+        // first pass: id, remoteId, revision and mimetype only, payloads
+        // are fetched later for the items the hashtable reports as changed.
+        // Usually started by the main sink's connect() already.
+        prefetch();
+        if ( !m_CollectionFetches.isEmpty() ) {
+            QEventLoop loop;
+            QObject::connect ( this, SIGNAL ( collectionsFetched() ), &loop, SLOT ( quit() ) );
+            loop.exec();
+        }
 
-        if ( !job->exec() )
+        const QString fetchError = m_FetchError;
+        QHash<Collection::Id, Item::List> fetched = m_FetchedItems;
+        discardPrefetch();
+        if ( !fetchError.isEmpty() )
         {
-            error ( OSYNC_ERROR_IO_ERROR, job->errorText() );
+            invalidateCollections();
+            error ( OSYNC_ERROR_IO_ERROR, fetchError );
             return;
         }
-    
+
+        for ( QHash<Collection::Id, Item::List>::const_iterator it = fetched.constBegin(); it != fetched.constEnd(); ++it )
+            processItems( it.value(), it.key() );
+
+        finishGetChanges();
+}
+
+void DataSink::prefetch()
+{
+    // already running or done
+    if ( m_Prefetching )
+        return;
+
+    kDebug() << "fetching" << m_Urls.count() << "collections of" << m_Name;
+    m_Prefetching = true;
+    m_FetchError.clear();
+    m_FetchedItems.clear();
+
+    // all collections are fetched at the same time
+    foreach ( const Collection &c, collections() ) {
+        ItemFetchJob *job = new ItemFetchJob ( c, fetchSession( c.id() ) );
+        m_CollectionFetches.insert( job, c.id() );
+
+        QObject::connect ( job, SIGNAL ( itemsReceived ( const Akonadi::Item::List & ) ), this, SLOT ( slotItemsReceived ( const Akonadi::Item::List & ) ) );
+        QObject::connect ( job, SIGNAL ( result ( KJob * ) ), this, SLOT ( slotCollectionFetched ( KJob * ) ) );
+    }
+}
+
+bool DataSink::needsPrefetch() const
+{
+    if ( !osync_objtype_sink_is_enabled ( sink() ) )
+        return false;
+    // getChanges() will most likely get away without the fetch
+    if ( m_SkipUnchanged )
+        return false;
+    return true;
+}
+
+void DataSink::discardPrefetch()
+{
+    // results of jobs still running are ignored from now on
+    m_CollectionFetches.clear();
+    m_FetchedItems.clear();
+    m_FetchError.clear();
+    m_Prefetching = false;
+}
+
+Session *DataSink::commitSession()
+{
+    const QList<Session*> busy = m_TransactionSessions.values();
+    foreach ( Session *session, m_CommitSessions )
+        if ( !busy.contains( session ) )
+            return session;
+
+    // the scheduler keeps at most CommitWindow transactions in flight, so there are never more sessions
+    Session *session = new Session ( "akonadi-sync-" + m_Name.toLatin1() + "-commit-"
+                                     + QByteArray::number( m_CommitSessions.count() ), this );
+    m_CommitSessions.append( session );
+    return session;
+}
+
+Session *DataSink::fetchSession( Collection::Id collection )
+{
+    // sessions run their jobs one after another, so each collection gets its own
+    if ( collection == m_PrimaryCollection )
+        return m_Session;
+
+    Session *session = m_FetchSessions.value( collection );
+    if ( !session ) {
+        session = new Session ( "akonadi-sync-" + m_Name.toLatin1() + '-' + QByteArray::number( collection ), this );
+        m_FetchSessions.insert( collection, session );
+    }
+    return session;
+}
+
+void DataSink::slotCollectionFetched ( KJob *job )
+{
+    // discarded by discardPrefetch()
+    if ( !m_CollectionFetches.remove( job ) )
+        return;
+    if ( job->error() && m_FetchError.isEmpty() )
+        m_FetchError = job->errorText();
+
+    if ( m_CollectionFetches.isEmpty() )
+        emit collectionsFetched();
 }
 
 void DataSink::slotItemsReceived ( const Item::List &items )
 {
-    kDebug();
-    kDebug() << "retrieved" << items.count() << "items";
-    Akonadi::MimeTypeChecker checker;
-    checker.addWantedMimeType( m_MimeType );
+    QHash<KJob*, Collection::Id>::const_iterator fetch = m_CollectionFetches.constFind( qobject_cast<KJob*>( sender() ) );
+    if ( fetch == m_CollectionFetches.constEnd() )
+        return;
+
+    // kept until getChanges() knows the state of the hashtable
+    m_FetchedItems[ fetch.value() ] += items;
+}
 
+void DataSink::processItems ( const Item::List &items, Collection::Id collection )
+{
+    SYNC_TRACE( 1, ItemsReceived, items.count(), m_Urls.count() );
+    m_ReceivedItems += items.count();
+    if ( metrics() )
+        metrics()->add( SyncMetrics::ItemsFetched, items.count() );
     Q_FOREACH ( const Item& item, items ) {
+        const QString itemUid = uid( collection, item.remoteId() );
+        if ( !item.remoteId().isEmpty() )
+            m_RemoteIdIndex.insert( itemUid, item.id() );
       // report only items of given mimeType
-        if (  checker.isWantedItem( item ) )
-	  reportChange ( item );
-	else
-            kDebug() << item.id() <<  item.mimeType() << "skipped!";
+        if (  m_MimeTypeChecker.isWantedItem( item ) ) {
+            if ( isModified( item, itemUid ) ) {
+                m_ChangedItems.append( item );
+                m_ChangedUids.insert( item.id(), itemUid );
+            }
+        }
+	else {
+            ++m_SkippedItems;
+            if ( metrics() )
+                metrics()->add( SyncMetrics::ItemsSkipped );
+        }
+    }
+}
+
+bool DataSink::isModified ( const Item& item, const QString &uid )
+{
+    // let reportChange() complain about it
+    if ( item.remoteId().isEmpty() || uid.isEmpty() )
+        return true;
+
+    OSyncError *oerror = 0;
+    OSyncHashTable *hashtable = osync_objtype_sink_get_hashtable ( sink() );
+
+    OSyncChange *change = osync_change_new ( &oerror );
+    if ( !change ) {
+        osync_error_unref ( &oerror );
+        return true;
+    }
+
+    // only the revision is known without the payload, the stored
+    // fingerprint is kept until reportChange() can compare the content
+    const QString stored = QString::fromLatin1( osync_hashtable_get_hash ( hashtable, uid.toLatin1().data() ) );
+    const bool modified = ( revisionPart( stored ) != getHash( item.id(), item.revision() ) );
+    if ( !modified ) {
+        // mark as seen, otherwise it is reported as deleted later on
+        osync_change_set_uid ( change, uid.toLatin1().data() );
+        osync_change_set_hash ( change, stored.toLatin1().data() );
+        osync_change_set_changetype ( change, OSYNC_CHANGE_TYPE_UNMODIFIED );
+        osync_hashtable_update_change ( hashtable, change );
+        if ( metrics() )
+            metrics()->add( SyncMetrics::UnmodifiedSkipped );
+        SYNC_TRACE( 2, UnmodifiedSkipped, item.id(), item.revision() );
     }
-    kDebug() << "slotItemsReceived done";
+    osync_change_unref ( change );
+
+    return modified;
 }
 
-void DataSink::reportChange ( const Item& item )
+bool DataSink::reportChangedItems()
 {
-    kDebug() << ">>>>>>>>>>>>>>>>>>>";
-    kDebug() << "Id:" << item.id() << "\n";
-    kDebug() << "RemoteId:" << item.remoteId() << "\n";
-    kDebug() << "Mime:" << item.mimeType() << "\n";
-    kDebug() << "Revision:" << item.revision() << "\n";
-    kDebug() << "StorageCollectionId:" << item.storageCollectionId() << "\n";
-    kDebug() << "Url:" << item.url() << "\n";
-    kDebug() << "mtime:" << item.modificationTime().toString(Qt::ISODate) << "\n";
-//     kDebug() << "mtime:" << (uint) item.modificationTime().toTime_t () << "\n";
+    kDebug() << m_ChangedItems.count() << "changed items";
+
+    // cached conversions need no payload at all
+    Item::List misses;
+    if ( m_Cache ) {
+        m_Cache->resetStatistics();
+        foreach ( const Item &item, m_ChangedItems ) {
+            QByteArray payload;
+            QByteArray fingerprint;
+            if ( !m_Cache->lookup( item.id(), item.revision(), m_CacheFormat, &payload )
+                 || !m_Cache->lookup( item.id(), item.revision(), FingerprintFormat, &fingerprint ) ) {
+                misses.append( item );
+                continue;
+            }
+            SYNC_TRACE( 2, CacheHit, item.id(), item.revision() );
+            reportChange ( item, m_ChangedUids.value( item.id() ), payload, fingerprint );
+            if ( !context() )
+                return false;
+        }
+        m_Cache->reportStatistics( m_Name );
+    } else {
+        misses = m_ChangedItems;
+    }
+
+    for ( int i = 0; i < misses.count(); i += PayloadFetchBatchSize ) {
+        ItemFetchJob *job = new ItemFetchJob ( misses.mid( i, PayloadFetchBatchSize ), m_Session );
+        if ( m_PayloadParts.isEmpty() ) {
+            job->fetchScope().fetchFullPayload();
+        } else {
+            foreach ( const QByteArray &part, m_PayloadParts )
+                job->fetchScope().fetchPayloadPart( part );
+        }
+
+        if ( !job->exec() ) {
+            error ( OSYNC_ERROR_IO_ERROR, job->errorText() );
+            return false;
+        }
+        SYNC_TRACE( 1, PayloadBatchFetched, job->items().count(), misses.count() - i - job->items().count() );
+
+        foreach ( const Item &item, job->items() ) {
+            // the size akonadi keeps, the payload data would be serialized again
+            if ( metrics() )
+                metrics()->add( SyncMetrics::BytesFetched, item.size() );
+            reportChange ( item, m_ChangedUids.value( item.id() ) );
+            // reportChange() reports errors on the context itself
+            if ( !context() )
+                return false;
+        }
+    }
 
-    if ( item.remoteId().isEmpty() )
+    m_ChangedItems.clear();
+    m_ChangedUids.clear();
+    m_Serializer.reportStatistics( m_Name );
+    return true;
+}
+
+void DataSink::reportChange ( const Item& item, const QString &uid, const QByteArray &cached, const QByteArray &cachedFingerprint )
+{
+    if ( item.remoteId().isEmpty() || uid.isEmpty() )
     {
+        kDebug() << "item" << item.id() << "has no remote identifier";
         error( OSYNC_ERROR_EXPECTED, "item remote identifier missing" );
         return;
     }
     OSyncChange *change = 0;
-    QString hash = getHash( item.id(), item.revision() ) ;
-
-    kDebug() << hash;
-    kDebug() << "item.payloadData().data()" << "\n" << item.payloadData().data();
 
     OSyncFormatEnv *formatenv = osync_plugin_info_get_format_env ( pluginInfo() );
 
@@ -290,57 +753,109 @@ void DataSink::reportChange ( const Item& item )
         return;
     }
 
-    osync_change_set_uid ( change,  item.remoteId().toLatin1().data() );
+    QByteArray payload = cached;
+    if ( payload.isEmpty() )
+    {
+        payload = m_Serializer.serialize ( item );
+        if ( payload.isEmpty() )
+        {
+            osync_change_unref(change);
+            error( OSYNC_ERROR_GENERIC, QString( "Unable to convert item %1 to %2" ).arg( item.id() ).arg( m_Format ) );
+            return;
+        }
+        if ( m_Cache )
+            m_Cache->insert( item.id(), item.revision(), m_CacheFormat, payload );
+    }
+    // of the payload as akonadi stores it, so the conversion policy does not matter
+    QByteArray fingerprint = cachedFingerprint;
+    if ( fingerprint.isEmpty() ) {
+        fingerprint = m_Serializer.fingerprint( item );
+        if ( m_Cache && !fingerprint.isEmpty() )
+            m_Cache->insert( item.id(), item.revision(), FingerprintFormat, fingerprint );
+    }
+
+    osync_change_set_uid ( change,  uid.toLatin1().data() );
 //     osync_change_set_uid ( change, QString::number( item.id() ).toLatin1() );
-    osync_change_set_hash ( change, getHash( item.id(), item.revision() ).toLatin1().data() );
+    const QString hash = getHash( item.id(), item.revision(), fingerprint );
+    osync_change_set_hash ( change, hash.toLatin1().data() );
 
     OSyncChangeType changetype = osync_hashtable_get_changetype(hashtable, change);
+    // flags, tags and attributes bump the revision too, the peer only sees the payload
+    if ( changetype == OSYNC_CHANGE_TYPE_MODIFIED ) {
+        const QString stored = QString::fromLatin1( osync_hashtable_get_hash ( hashtable, uid.toLatin1().data() ) );
+        if ( !fingerprintPart( stored ).isEmpty() && fingerprintPart( stored ) == fingerprintPart( hash ) )
+            changetype = OSYNC_CHANGE_TYPE_UNMODIFIED;
+    }
     osync_change_set_changetype(change, changetype);
 
-    osync_hashtable_update_change ( hashtable, change );
-
     if ( changetype == OSYNC_CHANGE_TYPE_UNMODIFIED ) {
-        kDebug()<< "skipped (unmodified)" << change;
+        SYNC_TRACE( 2, UnmodifiedSkipped, item.id(), item.revision() );
+        // keeps the new revision, so the content is not compared again
+        osync_hashtable_update_change ( hashtable, change );
+        if ( metrics() )
+            metrics()->add( SyncMetrics::UnmodifiedSkipped );
         osync_change_unref(change);
         osync_error_unref(&oerror);
         return;
     }
     // Now you can set the data for the object
 
+    osync_hashtable_update_change ( hashtable, change );
+
     OSyncObjFormat *format = osync_format_env_find_objformat ( formatenv, m_Format.toLatin1().data() );
-    int newDataSize = item.payloadData().size();
-    char newData[newDataSize];
-    memcpy(newData, item.payloadData().data(), newDataSize);
-//     OSyncData *odata = osync_data_new ( item.payloadData().data() , item.payloadData().size(), format, &error );
-    OSyncData *odata = osync_data_new ( newData, newDataSize, format, &oerror );
+    // the data takes ownership of this buffer and g_free()s it
+    char *newData = PayloadSerializer::toOSyncBuffer ( payload );
+    OSyncData *odata = osync_data_new ( newData, payload.size(), format, &oerror );
     if ( !odata )
     {
 //       osync_change_unref((OSyncChange*) change);
+      g_free(newData);
       osync_change_unref(change);
       warning(oerror);
       return;
     }
     osync_error_unref(&oerror);
 
-    kDebug()<< "context" << context();
 //     do I need this here
 //     osync_data_set_objtype( odata, m_Name.toLatin1().data() );
     osync_change_set_data ( change, odata );
-    kDebug()<< "data  " << odata;
-//     not sure but it gets probably delete together with change below
-//     osync_data_unref ( (OSyncData *) odata );
+    // the change holds its own reference now
+    osync_data_unref ( odata );
 //     osync_hashtable_update_change ( hashtable, change ); //Do we need an update after setting data?
 
     osync_context_report_change ( context(), change );
+    SYNC_TRACE( 2, ChangeReported, item.id(), changetype );
+    if ( metrics() ) {
+        metrics()->add( changetype == OSYNC_CHANGE_TYPE_ADDED ? SyncMetrics::AddedReported : SyncMetrics::ModifiedReported );
+        metrics()->add( SyncMetrics::BytesReported, payload.size() );
+    }
 //     osync_hashtable_update_change ( hashtable, change );
 //     kDebug()<< "change" << change;
     osync_change_unref ( change );
+}
+
+void DataSink::finishGetChanges()
+{
+    kDebug();
+
+    // we have seen every item of the collections, commit() can rely on the index now
+    m_RemoteIdIndexValid = true;
 
-    kDebug()<< "<<<<<<<<<<<<<< change done";
+    kDebug() << m_SkippedItems << "of" << m_ReceivedItems << "items skipped, not of mimetype" << m_MimeType;
+    osync_trace ( TRACE_INTERNAL, "%s: %d of %d items skipped, not of mimetype %s", m_Name.toLatin1().data(),
+                  m_SkippedItems, m_ReceivedItems, m_MimeType.toLatin1().data() );
 
+    // second pass: payloads of the changed items only
+    if ( !reportChangedItems() )
+        return;
+
+    reportDeletedItems();
+
+    kDebug() << "got all changes success().";
+    success();
 }
 
-void DataSink::slotGetChangesFinished ( KJob * )
+void DataSink::reportDeletedItems()
 {
     kDebug();
     OSyncError *oerror = 0;
@@ -348,26 +863,34 @@ void DataSink::slotGetChangesFinished ( KJob * )
     OSyncFormatEnv *formatenv = osync_plugin_info_get_format_env( pluginInfo() );
     OSyncHashTable *hashtable = osync_objtype_sink_get_hashtable ( sink() );
     OSyncList *u, *uids = osync_hashtable_get_deleted ( hashtable );
+    if ( !uids )
+        return;
+
+    // the same for every deleted change, mass deletions report thousands of them
+    OSyncObjFormat *format = osync_format_env_find_objformat( formatenv, m_Format.toLatin1().data() );
+    const QByteArray objtype = m_Name.toLatin1();
+    int reported = 0;
+
     for ( u = uids; u; u = u->next )
     {
-        QString uid ( ( char * ) u->data );
-        kDebug() << "going to delete with uid:" << uid;
+        const char *uid = ( const char * ) u->data;
+
+        if ( isUnavailable( QString::fromLatin1( uid ) ) ) {
+            markUnmodified( hashtable, uid );
+            continue;
+        }
 
         OSyncChange *change = osync_change_new ( &oerror );
         if ( !change )
         {
-            osync_change_unref ( change );
             warning ( oerror );
             continue;
-        }           
+        }
 
-        osync_change_set_uid ( change, uid.toLatin1().data() );
-	QString hash = osync_change_get_hash(change);
-	kDebug() << "hash:" << hash;
+        osync_change_set_uid ( change, uid );
         osync_change_set_changetype ( change, OSYNC_CHANGE_TYPE_DELETED );
-	
-        OSyncObjFormat *format = osync_format_env_find_objformat( formatenv, m_Format.toLatin1().data() );
-        oerror = 0;
+
+        // every change needs its own data, the engine may convert it in place
         OSyncData *data = osync_data_new( NULL, 0, format, &oerror );
         if ( !data ) {
             osync_change_unref( change );
@@ -375,44 +898,31 @@ void DataSink::slotGetChangesFinished ( KJob * )
             continue;
         }
 
-        osync_data_set_objtype( data, m_Name.toLatin1().data() );
+        osync_data_set_objtype( data, objtype.constData() );
         osync_change_set_data( change, data );
         osync_data_unref((OSyncData *)data);
-//         osync_hashtable_update_change ( hashtable, change );
 
         osync_context_report_change ( context(), change );
-
         osync_hashtable_update_change ( hashtable, change );
-	
         osync_change_unref ( change );
+        ++reported;
     }
+    if ( metrics() )
+        metrics()->add( SyncMetrics::DeletedReported, reported );
+    SYNC_TRACE( 1, DeletedReported, reported, 0 );
     osync_list_free ( uids );
-    osync_error_unref(&oerror);
-    
-    kDebug() << "got all changes success().";
-    success();
 }
 
 void DataSink::commit ( OSyncChange *change )
 {
-    kDebug();
-
     OSyncHashTable *hashtable = osync_objtype_sink_get_hashtable ( sink() );
 
     QString remoteId = QString::fromLatin1 ( osync_change_get_uid ( change ) );
-    QString hash = QString::fromLatin1 ( osync_change_get_hash ( change ) );
     
     //TODO: use id to identify items
 //     int id = idFromHash(hash);
-//     kDebug() << "change   id:" << id;
-    kDebug() << "change  uid :" << remoteId;
-    kDebug() << "change hash:" << hash;
-    kDebug() << "objform:" << osync_objformat_get_name ( osync_change_get_objformat ( change ) );
-
-
-    Akonadi::Collection col = collection();
 
-    if ( !col.isValid() ) {
+    if ( !resolveCollections() ) {
         error( OSYNC_ERROR_GENERIC, "Invalid collection.");
         return;
     }
@@ -420,91 +930,35 @@ void DataSink::commit ( OSyncChange *change )
     switch ( (OSyncChangeType) osync_change_get_changetype ( change ) )
     {
     case OSYNC_CHANGE_TYPE_ADDED:
-    {
-        char *plain = 0; // plain is freed by data
-        osync_data_get_data ( osync_change_get_data ( change ), &plain, /*size*/0 );
-        QString str = QString::fromUtf8( plain );
-//         QString str = QString::fromLatin1( plain );
-//         QString str = QString::fromLocal8Bit( plain );
-	kDebug() << "data: " << str;
-
-        Item item; 
-        setPayload ( &item, str );
-// 	item.setId((qint64) remoteId.toLongLong());
-        item.setRemoteId( remoteId );
-
-        ItemCreateJob *job = new Akonadi::ItemCreateJob ( item, col );
-        if ( ! job->exec() ) {
-            error( OSYNC_ERROR_GENERIC, "Unable to create job for item.");
-            return;
-        } else {
-	  item = job->item(); // handle !job->exec in return too..
-	  if ( ! item.isValid() ) {
-            error( OSYNC_ERROR_GENERIC, "Unable to fetch item.");
-            return;
-	  }
-	  //TODO: Test
-//     kDebug() << "change  qint:" << remoteId.toLongLong();
-// 	  item.setId((qint64) remoteId.toLongLong());
-          osync_change_set_uid ( change, item.remoteId().toLatin1().data() );
-          osync_change_set_hash ( change, getHash( item.id(), item.revision() ).toLatin1().data() );
-	}
-        break;
-    }
-
     case OSYNC_CHANGE_TYPE_MODIFIED:
-    {
-        char *plain = 0; // plain is freed by data
-        osync_data_get_data ( osync_change_get_data ( change ), &plain, /*size*/0 );
-        QString str = QString::fromUtf8( plain );
-
-	Item item = fetchItem ( remoteId );
-
-        if ( ! item.isValid() ) {
-            error( OSYNC_ERROR_GENERIC, "Unable to fetch item.");
-            return;
-        }
-        setPayload ( &item, str );
-        kDebug() << "data" << str;
-
-        ItemModifyJob *modifyJob = new Akonadi::ItemModifyJob ( item );
-        if ( ! modifyJob->exec() ) {
-            error ( OSYNC_ERROR_GENERIC, "Unable to run modify job.");
-            return;
-        } else {
-	  item = modifyJob->item();
-	  if ( ! item.isValid() ) {
-            error( OSYNC_ERROR_GENERIC, "Unable to modify item.");
-            return;
-	  }
-// ### Do Ineed this also here?
-//	  kDebug() << "change  qint:" << remoteId.toLongLong();
-// 	  item.setId((qint64) remoteId.toLongLong());
-          osync_change_set_uid ( change, item.remoteId().toLatin1().data() );
-          osync_change_set_hash ( change, getHash( item.id(), item.revision() ).toLatin1().data() );
-
-	}
-        break;
-    }
-
     case OSYNC_CHANGE_TYPE_DELETED:
     {
-        Item item = fetchItem ( remoteId );
-        if ( ! item.isValid() ) {
-	  // FIXME break or return?
-//             error( OSYNC_ERROR_GENERIC, "Unable to fetch item");
-            break; 
-        }
-
-//      kDebug() << "deleted: (testing skipped)" << remoteId;
-// comment out to skip deleting for testing
-        ItemDeleteJob *job = new ItemDeleteJob( item );
-        if ( ! job->exec() ) {
-            error( OSYNC_ERROR_GENERIC, "Unable to delete item");
-            return;
+        PendingCommit *pending = new PendingCommit;
+        pending->change = change;
+        pending->uid = remoteId;
+        if ( osync_change_get_changetype ( change ) != OSYNC_CHANGE_TYPE_DELETED ) {
+            char *plain = 0; // plain is freed by data
+            unsigned int size = 0;
+            osync_data_get_data ( osync_change_get_data ( change ), &plain, &size );
+            if ( metrics() )
+                metrics()->add( SyncMetrics::BytesCommitted, size );
+            SYNC_TRACE( 2, ChangeQueued, osync_change_get_changetype ( change ), size );
+            // KCal, libical and the KDE timezone and locale code are not thread-safe,
+            // so this stays on our thread while earlier chunks are being written
+            if ( !m_Serializer.deserialize ( &pending->item, QByteArray( plain ) ) ) {
+                delete pending;
+                error( OSYNC_ERROR_GENERIC, "Unable to parse item." );
+                return;
+            }
         }
-        osync_change_set_uid ( change, item.remoteId().toLatin1().data() );
-        break;
+        osync_change_ref ( change );
+        m_PendingCommits.append( pending );
+        // full chunks are started right away, without waiting for the server
+        startCommits();
+        // the uid does not change when the item is written, so the engine need
+        // not wait for the server. commit_timeout runs for each change.
+        success();
+        return;
     }
 
     case OSYNC_CHANGE_TYPE_UNMODIFIED:
@@ -524,67 +978,335 @@ void DataSink::commit ( OSyncChange *change )
     success();
 }
 
-bool DataSink::setPayload ( Item *item, const QString &str )
+void DataSink::commitAll()
 {
-    kDebug();
-    item->setMimeType ( m_MimeType );
-    kDebug()<< "To mimetype: " << m_MimeType;
-    switch ( m_type )
-    {
-    case Contacts:
-    {
-        kDebug() << "type = contacts";
-        KABC::VCardConverter converter;
-        KABC::Addressee vcard = converter.parseVCard ( str.toUtf8() );
-        item->setPayload<KABC::Addressee> ( vcard );
-        kDebug() << "payload: " << vcard.toString().toUtf8();
-        break;
+    kDebug() << m_PendingCommits.count() << "pending changes," << m_Scheduler.inFlight() << "transactions in flight";
+
+    // write what is left, the jobs only run while an event loop does
+    m_Flushing = true;
+    startCommits();
+    if ( !commitsIdle() ) {
+        QEventLoop loop;
+        QObject::connect ( this, SIGNAL ( commitsFinished() ), &loop, SLOT ( quit() ) );
+        loop.exec();
     }
-    case Calendars:
+    m_Flushing = false;
+
+    if ( !m_CommitErrors.isEmpty() ) {
+        const QString msg = QString( "%1 changes could not be written: %2" )
+                            .arg( m_CommitErrors.count() ).arg( m_CommitErrors.join( "; " ) );
+        m_CommitErrors.clear();
+        error( OSYNC_ERROR_GENERIC, msg );
+        return;
+    }
+    success();
+}
+
+void DataSink::startCommits()
+{
+    // prepareCommit() may spin an event loop, the outer call picks up what we leave here
+    if ( m_Dispatching )
+        return;
+    m_Dispatching = true;
+
+    Akonadi::Collection col = collection();
+
+    while ( m_Scheduler.canStart() ) {
+        QList<PendingCommit*> chunk;
+        if ( !m_RetryChunks.isEmpty() ) {
+            chunk = m_RetryChunks.takeFirst();
+        } else {
+            const int size = m_Scheduler.nextChunkSize( m_PendingCommits.count(), m_Flushing );
+            if ( size == 0 )
+                break;
+            fetchCommitTargets( size );
+            for ( int i = 0; i < size && !m_PendingCommits.isEmpty(); ++i ) {
+                PendingCommit *pending = m_PendingCommits.takeFirst();
+                if ( !col.isValid() ) {
+                    finishCommit( pending, "Invalid collection." );
+                    continue;
+                }
+                if ( prepareCommit( pending ) )
+                    chunk.append( pending );
+            }
+            if ( chunk.isEmpty() )
+                continue;
+        }
+        startChunk( chunk, col );
+    }
+
+    m_Dispatching = false;
+    if ( m_Flushing && commitsIdle() ) {
+        kDebug() << "all changes committed";
+        emit commitsFinished();
+    }
+}
+
+bool DataSink::commitsIdle() const
+{
+    return m_Scheduler.inFlight() == 0 && m_PendingCommits.isEmpty() && m_RetryChunks.isEmpty();
+}
+
+bool DataSink::prepareCommit ( PendingCommit *pending )
+{
+    switch ( (OSyncChangeType) osync_change_get_changetype ( pending->change ) )
     {
-        kDebug() << "type = events";
-        KCal::ICalFormat format;
-        KCal::Incidence *calEntry = format.fromString ( str.toUtf8() );
-        item->setPayload<IncidencePtr> ( IncidencePtr ( calEntry->clone() ) );
-        kDebug() << "payload: " << str.toUtf8();
-        break;
+    case OSYNC_CHANGE_TYPE_ADDED:
+    {
+        // new items always go to the first collection
+        pending->item.setRemoteId( pending->uid );
+        return true;
     }
-    case Todos:
+
+    case OSYNC_CHANGE_TYPE_MODIFIED:
     {
-        kDebug() << "type = todos";
-        KCal::ICalFormat format;
-        KCal::Incidence *todoEntry = format.fromString ( str.toUtf8() );
-        item->setPayload<IncidencePtr> ( IncidencePtr ( todoEntry->clone() ) );
-        kDebug() << "payload: " << str.toUtf8();
-        break;
+        // resolved by fetchCommitTargets() with the rest of the chunk
+        const Item item = m_CommitTargets.contains( pending->uid ) ? m_CommitTargets.take( pending->uid )
+                                                                    : fetchItem ( pending->uid );
+        if ( ! item.isValid() ) {
+            finishCommit( pending, "Unable to fetch item." );
+            return false;
+        }
+
+        pending->item.setId( item.id() );
+        pending->item.setRevision( item.revision() );
+        pending->item.setRemoteId( item.remoteId() );
+        // the peer never got the binaries above the inline limit, keep them
+        if ( m_Serializer.restoreLargeBinaries( &pending->item, item ) )
+            SYNC_TRACE( 2, BinariesRestored, item.id(), 0 );
+        return true;
     }
-    case Notes:
+
+    case OSYNC_CHANGE_TYPE_DELETED:
     {
-        kDebug() << "type = notes";
-        KCal::ICalFormat format;
-        KCal::Incidence *noteEntry = format.fromString ( str.toUtf8() );
-        item->setPayload<IncidencePtr> ( IncidencePtr ( noteEntry->clone() ) );
-        kDebug() << "payload: " << str.toUtf8();
-        break;
+        if ( !m_RemoteIdIndexValid )
+            buildRemoteIdIndex();
+
+        if ( !m_RemoteIdIndex.contains( pending->uid ) ) {
+            // already gone, nothing to delete
+            finishCommit( pending );
+            return false;
+        }
+        pending->item = Item( m_RemoteIdIndex.value( pending->uid ) );
+        return true;
     }
+
     default:
-        // should not happen
+        finishCommit( pending, "got invalid changetype" );
         return false;
     }
+}
 
-    return true;
+void DataSink::fetchCommitTargets ( int count )
+{
+    QHash<Item::Id, QString> uids;
+    Item::List items;
+    for ( int i = 0; i < count && i < m_PendingCommits.count(); ++i ) {
+        const PendingCommit *pending = m_PendingCommits.at( i );
+        if ( osync_change_get_changetype ( pending->change ) != OSYNC_CHANGE_TYPE_MODIFIED
+             || m_CommitTargets.contains( pending->uid ) )
+            continue;
+        if ( !m_RemoteIdIndexValid && !buildRemoteIdIndex() )
+            return;
+        if ( !m_RemoteIdIndex.contains( pending->uid ) )
+            continue;
+        const Item::Id id = m_RemoteIdIndex.value( pending->uid );
+        uids.insert( id, pending->uid );
+        items.append( Item( id ) );
+    }
+    if ( items.isEmpty() )
+        return;
+
+    // the payload is replaced anyway, the revision is what the modify job needs,
+    // and the binaries left out for the peer
+    ItemFetchJob *job = new ItemFetchJob ( items, m_Session );
+    if ( m_Serializer.maxInlineSize() > 0 )
+        job->fetchScope().fetchFullPayload();
+    if ( !job->exec() ) {
+        // prepareCommit() falls back to fetching them one by one
+        kDebug() << "unable to fetch commit targets:" << job->errorText();
+        return;
+    }
+    foreach ( const Item &item, job->items() )
+        if ( uids.contains( item.id() ) )
+            m_CommitTargets.insert( uids.value( item.id() ), item );
 }
 
-const Item DataSink::fetchItem ( int id )
+void DataSink::startChunk ( const QList<PendingCommit*> &chunk, const Akonadi::Collection &col )
 {
-    kDebug();
-  ItemFetchJob *fetchJob = new ItemFetchJob( Item( id ) );
-  fetchJob->fetchScope().fetchFullPayload();
+    SYNC_TRACE( 1, ChunkStarted, chunk.count(), m_Scheduler.inFlight() );
+
+    // a session runs its jobs one after another, so each transaction in flight has its own
+    Session *session = commitSession();
+    TransactionSequence *transaction = new TransactionSequence ( session );
+    QList<PendingCommit*> deleted;
+    Item::List deletedItems;
+
+    foreach ( PendingCommit *pending, chunk ) {
+        pending->errorText = QString();
+        KJob *job = 0;
+        switch ( (OSyncChangeType) osync_change_get_changetype ( pending->change ) )
+        {
+        case OSYNC_CHANGE_TYPE_ADDED:
+            job = new ItemCreateJob ( pending->item, col, transaction );
+            break;
+        case OSYNC_CHANGE_TYPE_MODIFIED:
+            job = new ItemModifyJob ( pending->item, transaction );
+            break;
+        default:
+            deleted.append( pending );
+            deletedItems.append( pending->item );
+            continue;
+        }
+        m_CommitJobs.insert( job, QList<PendingCommit*>() << pending );
+        QObject::connect ( job, SIGNAL ( result ( KJob * ) ), this, SLOT ( slotCommitJobResult ( KJob * ) ) );
+    }
+
+    // all deletes of the chunk go out as one job
+    if ( !deletedItems.isEmpty() ) {
+        KJob *job = new ItemDeleteJob ( deletedItems, transaction );
+        m_CommitJobs.insert( job, deleted );
+        QObject::connect ( job, SIGNAL ( result ( KJob * ) ), this, SLOT ( slotCommitJobResult ( KJob * ) ) );
+    }
+
+    m_Transactions.insert( transaction, chunk );
+    m_TransactionSessions.insert( transaction, session );
+    // the session is idle, so the transaction starts right away and nothing is queued before it
+    QTime time;
+    time.start();
+    m_TransactionTimes.insert( transaction, time );
+    m_Scheduler.chunkStarted();
+    // akonadi jobs start on their own, the result is handled in slotTransactionResult()
+    QObject::connect ( transaction, SIGNAL ( result ( KJob * ) ), this, SLOT ( slotTransactionResult ( KJob * ) ) );
+}
+
+void DataSink::slotTransactionResult ( KJob *transaction )
+{
+    QList<PendingCommit*> chunk = m_Transactions.take( transaction );
+    m_TransactionSessions.remove( transaction );
+    const int msecs = m_TransactionTimes.take( transaction ).elapsed();
+    if ( metrics() )
+        metrics()->addCommitLatency( msecs );
+    // commit() returns before its change is written, the transactions tell what a chunk costs
+    if ( !transaction->error() )
+        m_Budget->observe( SyncMetrics::Commit, msecs, chunk.count() );
+    m_Scheduler.chunkFinished();
+    SYNC_TRACE( 1, TransactionFinished, chunk.count(), transaction->error() );
+
+    if ( !transaction->error() ) {
+        foreach ( PendingCommit *pending, chunk )
+            finishCommit( pending, pending->errorText );
+    } else {
+        kDebug() << "transaction failed:" << transaction->errorText();
+        // the collection may be gone, check before the next change is committed
+        invalidateCollections();
+        if ( chunk.count() == 1 ) {
+            PendingCommit *pending = chunk.first();
+            finishCommit( pending, pending->errorText.isEmpty() ? transaction->errorText() : pending->errorText );
+        } else {
+            // the whole transaction was rolled back, retry one by one to find the offending changes
+            foreach ( PendingCommit *pending, chunk )
+                m_RetryChunks.append( QList<PendingCommit*>() << pending );
+        }
+    }
+
+    startCommits();
+}
+
+void DataSink::slotCommitJobResult ( KJob *job )
+{
+    QList<PendingCommit*> pendings = m_CommitJobs.take( job );
+
+    if ( job->error() ) {
+        kDebug() << "commit job failed:" << job->errorText();
+        foreach ( PendingCommit *pending, pendings )
+            pending->errorText = job->errorText();
+        return;
+    }
+
+    foreach ( PendingCommit *pending, pendings ) {
+        Item item;
+        if ( ItemCreateJob *createJob = qobject_cast<ItemCreateJob*>( job ) )
+            item = createJob->item();
+        else if ( ItemModifyJob *modifyJob = qobject_cast<ItemModifyJob*>( job ) )
+            item = modifyJob->item();
+        else {
+            // deleted
+            m_RemoteIdIndex.remove( pending->uid );
+            continue;
+        }
+
+        if ( ! item.isValid() ) {
+            pending->errorText = "Unable to fetch item.";
+            continue;
+        }
+        // modified items stay in their collection, created ones are in the first
+        if ( osync_change_get_changetype ( pending->change ) == OSYNC_CHANGE_TYPE_ADDED )
+            pending->uid = uid( m_PrimaryCollection, item.remoteId() );
+        osync_change_set_uid ( pending->change, pending->uid.toLatin1().data() );
+        // fingerprint the payload we wrote, so the revision bump of the
+        // resource storing the item is not reported back as a change
+        const QByteArray fingerprint = m_Serializer.fingerprint ( pending->item );
+        if ( m_Cache && !fingerprint.isEmpty() ) {
+            const QByteArray payload = m_Serializer.serialize ( pending->item );
+            if ( !payload.isEmpty() ) {
+                m_Cache->insert( item.id(), item.revision(), m_CacheFormat, payload );
+                m_Cache->insert( item.id(), item.revision(), FingerprintFormat, fingerprint );
+            }
+        }
+        osync_change_set_hash ( pending->change, getHash( item.id(), item.revision(), fingerprint ).toLatin1().data() );
+        m_RemoteIdIndex.insert( pending->uid, item.id() );
+    }
+}
+
+void DataSink::finishCommit ( PendingCommit *pending, const QString &errorText )
+{
+    if ( errorText.isEmpty() ) {
+        OSyncHashTable *hashtable = osync_objtype_sink_get_hashtable ( sink() );
+        osync_hashtable_update_change ( hashtable, pending->change );
+        ++m_CommittedChanges;
+        SYNC_TRACE( 2, ChangeCommitted, pending->item.id(), osync_change_get_changetype ( pending->change ) );
+        if ( metrics() ) {
+            switch ( (OSyncChangeType) osync_change_get_changetype ( pending->change ) )
+            {
+            case OSYNC_CHANGE_TYPE_ADDED:
+                metrics()->add( SyncMetrics::AddedCommitted );
+                break;
+            case OSYNC_CHANGE_TYPE_MODIFIED:
+                metrics()->add( SyncMetrics::ModifiedCommitted );
+                break;
+            default:
+                metrics()->add( SyncMetrics::DeletedCommitted );
+            }
+        }
+    } else {
+        if ( metrics() )
+            metrics()->add( SyncMetrics::CommitErrors );
+        // commit() has reported success already, so the engine keeps a mapping
+        // for the change. Stored right away, the next sync is a slow sync.
+        kDebug() << "unable to write" << pending->uid << ":" << errorText;
+        m_CommitErrors << pending->uid + ": " + errorText;
+        if ( !m_CommitFailed ) {
+            m_CommitFailed = true;
+            setState( "commitfailed", "1" );
+        }
+    }
+
+    osync_change_unref ( pending->change );
+    delete pending;
+}
+
+const Item DataSink::fetchItem ( Item::Id id )
+{
+  // callers only need the revision, the payload is replaced by the change
+  // except for the binaries left out for the peer
+  ItemFetchJob *fetchJob = new ItemFetchJob( Item( id ), m_Session );
+  if ( m_Serializer.maxInlineSize() > 0 )
+    fetchJob->fetchScope().fetchFullPayload();
 
   if( fetchJob->exec() ) {
     foreach ( const Item &item, fetchJob->items() ) {
       if(  item.id() == id ) {
-        kDebug() << "got item";
         return item;
       }
     }
@@ -595,24 +1317,168 @@ const Item DataSink::fetchItem ( int id )
   return Item();
 }
 
-const Item DataSink::fetchItem ( const QString& remoteId )
+const Item DataSink::fetchItem ( const QString& uid )
+{
+
+    if ( !m_RemoteIdIndexValid && !buildRemoteIdIndex() )
+        return Item();
+
+    QHash<QString, Item::Id>::const_iterator it = m_RemoteIdIndex.constFind( uid );
+    if ( it == m_RemoteIdIndex.constEnd() )
+        // no such item found?
+        // we'll check after calling this function
+        return Item();
+
+    return fetchItem( it.value() );
+}
+
+bool DataSink::buildRemoteIdIndex()
 {
     kDebug();
 
-    ItemFetchJob *fetchJob = new ItemFetchJob ( collection() );
-    fetchJob->fetchScope().fetchFullPayload();
-    if ( fetchJob->exec() )
+    m_RemoteIdIndex.clear();
+
+    // no payload here, id and remoteId are all we need
+    foreach ( const Collection &col, collections() ) {
+        ItemFetchJob *fetchJob = new ItemFetchJob ( col, m_Session );
+        if ( !fetchJob->exec() )
+            return false;
+
         foreach ( const Item &item, fetchJob->items() )
-        if ( item.remoteId() == remoteId )
-            return item;
-    // no such item found?
-    // we'll check after calling this function
-    return Item();
+            if ( !item.remoteId().isEmpty() )
+                m_RemoteIdIndex.insert( uid( col.id(), item.remoteId() ), item.id() );
+    }
+
+    kDebug() << "indexed" << m_RemoteIdIndex.count() << "items";
+    m_RemoteIdIndexValid = true;
+    return true;
+}
+
+QString DataSink::collectionState()
+{
+    QStringList states;
+    foreach ( const Collection &col, collections() ) {
+        CollectionStatisticsJob *job = new CollectionStatisticsJob ( col, m_Session );
+        if ( !job->exec() )
+            return QString();
+
+        const CollectionStatistics statistics = job->statistics();
+        states << QString::number( statistics.count() ) + ':' + QString::number( statistics.size() );
+    }
+    return states.join( ";" );
+}
+
+bool DataSink::unchangedSinceLastSync()
+{
+    // taken before the items are fetched, so that later changes are not
+    // hidden by the state stored in syncDone()
+    m_CollectionState = collectionState();
+    if ( m_CollectionState.isEmpty() )
+        return false;
+
+    m_SkippedSyncs = state( "skippedsyncs" ).toInt();
+    const uint lastScan = state( "fullscan" ).toUInt();
+    const uint now = QDateTime::currentDateTime().toTime_t();
+    if ( m_SkippedSyncs >= m_SkipUnchangedMaxSyncs || now - lastScan > uint( SkipUnchangedMaxAge ) ) {
+        kDebug() << m_SkippedSyncs << "syncs skipped, last full scan at" << lastScan << ", scanning again";
+        return false;
+    }
+
+    const QString stored = state( "collectionstate" );
+    const bool unchanged = ( !stored.isEmpty() && m_CollectionState == stored );
+    kDebug() << "collection state" << m_CollectionState << ( unchanged ? "unchanged" : "changed" );
+    return unchanged;
+}
+
+QString DataSink::state( const char *key )
+{
+    OSyncError *oerror = 0;
+    OSyncSinkStateDB *statedb = osync_objtype_sink_get_state_db ( sink() );
+    char *value = osync_sink_state_get ( statedb, key, &oerror );
+    if ( !value ) {
+        osync_error_unref ( &oerror );
+        return QString();
+    }
+
+    const QString result = QString::fromLatin1( value );
+    g_free ( value );
+    return result;
+}
+
+void DataSink::setState( const char *key, const QString &value )
+{
+    OSyncError *oerror = 0;
+    OSyncSinkStateDB *statedb = osync_objtype_sink_get_state_db ( sink() );
+    if ( !osync_sink_state_set ( statedb, key, value.toLatin1().data(), &oerror ) ) {
+        kDebug() << "unable to store" << key << ":" << osync_error_print ( &oerror );
+        osync_error_unref ( &oerror );
+    }
+}
+
+void DataSink::reportAllUnmodified()
+{
+    OSyncHashTable *hashtable = osync_objtype_sink_get_hashtable ( sink() );
+
+    // nothing has been reported yet, so these are all known entries
+    OSyncList *u, *uids = osync_hashtable_get_deleted ( hashtable );
+    for ( u = uids; u; u = u->next )
+        markUnmodified( hashtable, ( const char * ) u->data );
+    osync_list_free ( uids );
+}
+
+void DataSink::markUnmodified( OSyncHashTable *hashtable, const char *uid )
+{
+    OSyncError *oerror = 0;
+    OSyncChange *change = osync_change_new ( &oerror );
+    if ( !change ) {
+        osync_error_unref ( &oerror );
+        return;
+    }
+    osync_change_set_uid ( change, uid );
+    osync_change_set_hash ( change, osync_hashtable_get_hash ( hashtable, uid ) );
+    osync_change_set_changetype ( change, OSYNC_CHANGE_TYPE_UNMODIFIED );
+    osync_hashtable_update_change ( hashtable, change );
+    osync_change_unref ( change );
+    if ( metrics() )
+        metrics()->add( SyncMetrics::UnmodifiedSkipped );
+}
+
+bool DataSink::isUnavailable( const QString &uid ) const
+{
+    foreach ( const QString &prefix, m_UnavailablePrefixes )
+        if ( uid.startsWith( prefix ) )
+            return true;
+    return false;
 }
 
 void DataSink::syncDone()
 {
     kDebug() << "sync for sink member done";
+    discardPrefetch();
+    m_CommitTargets.clear();
+    m_RemoteIdIndex.clear();
+    m_RemoteIdIndexValid = false;
+
+    if ( m_SkipUnchanged ) {
+        // our own commits changed the collection, take a fresh look at it
+        QString current = ( m_CommittedChanges == 0 ) ? m_CollectionState : collectionState();
+        if ( current.isEmpty() )
+            current = collectionState();
+        if ( !current.isEmpty() )
+            setState( "collectionstate", current );
+
+        if ( m_Skipping ) {
+            setState( "skippedsyncs", QString::number( m_SkippedSyncs + 1 ) );
+        } else {
+            setState( "skippedsyncs", "0" );
+            setState( "fullscan", QString::number( QDateTime::currentDateTime().toTime_t() ) );
+        }
+    }
+    // a slow sync requested by connect() has repaired the mappings
+    if ( !m_CommitFailed )
+        setState( "commitfailed", QString() );
+    if ( !qgetenv( "AKONADI_SYNC_TRACE" ).isEmpty() )
+        SyncTrace::dump();
     // Do we need this in 0.40???
 //     OSyncError *error = 0;
 //     osync_objtype_sink_save_hashtable ( sink() , &error );
@@ -623,10 +1489,51 @@ void DataSink::syncDone()
     success();
 }
 
+int DataSink::timeout( SyncMetrics::Phase phase ) const
+{
+    return m_Budget ? m_Budget->timeout( phase ) : SinkBase::timeout( phase );
+}
+
+void DataSink::phaseFinished( SyncMetrics::Phase phase, int msecs )
+{
+    switch ( phase )
+    {
+    case SyncMetrics::GetChanges:
+        m_Budget->observe( phase, msecs, m_ReceivedItems );
+        break;
+    case SyncMetrics::Commit:
+        // see slotTransactionResult()
+        break;
+    case SyncMetrics::CommitAll:
+        // not budgeted, see TimeoutBudget::timeout()
+        break;
+    case SyncMetrics::SyncDone:
+        m_Budget->observe( phase, msecs, 1 );
+        m_Budget->save();
+        break;
+    default:
+        m_Budget->observe( phase, msecs, 1 );
+    }
+}
+
 QString DataSink::getHash( int id, int rev ) {
   return QString::number(id) + "-" + QString::number( rev ) ;
 }
 
+QString DataSink::getHash( int id, int rev, const QByteArray &fingerprint ) {
+  if ( fingerprint.isEmpty() )
+    return getHash( id, rev );
+  return getHash( id, rev ) + "-" + QString::fromLatin1( fingerprint );
+}
+
+QString DataSink::revisionPart( const QString &hash ) {
+  return hash.section( '-', 0, 1 );
+}
+
+QString DataSink::fingerprintPart( const QString &hash ) {
+  return hash.section( '-', 2 );
+}
+
 int DataSink::idFromHash( const QString hash) {
   QString str = hash;
   str.remove(QRegExp("-.*"));
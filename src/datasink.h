@@ -21,17 +21,32 @@
 #define DATASINK_H
 
 #include "sinkbase.h"
+#include "commitscheduler.h"
+#include "payloadserializer.h"
 
 #include <akonadi/collection.h>
 #include <akonadi/itemfetchjob.h>
+#include <akonadi/mimetypechecker.h>
 
 #include <opensync/opensync.h>
 #include <opensync/opensync-plugin.h>
 #include <opensync/opensync-data.h>
 #include <opensync/opensync-format.h>
 
+#include <QHash>
+#include <QList>
+#include <QStringList>
+#include <QTime>
+
 #include <boost/shared_ptr.hpp>
 
+namespace Akonadi {
+class Session;
+}
+
+class ConversionCache;
+class TimeoutBudget;
+
 using namespace Akonadi;
 
 /**
@@ -49,29 +64,138 @@ class DataSink : public SinkBase
 
     bool initialize(OSyncPlugin *plugin, OSyncPluginInfo *info, OSyncObjTypeSink *sink, OSyncError **error );
 
+    void connect();
     void getChanges();
     void commit( OSyncChange *change );
+    void commitAll();
     void syncDone();
 
+    /**
+     * Opens the session all fetch and commit jobs of the sink run in, and the
+     * fetch sessions of further collections, and warms up their connections
+     * to the server. Kept for the whole sync.
+     */
+    void openSession();
+
+    /**
+     * Starts the metadata fetch of getChanges() ahead of time, so that the
+     * fetches of all sinks run at the same time.
+     */
+    void prefetch();
+
+    /**
+     * Returns false if the sink is disabled or getChanges() is unlikely to fetch.
+     */
+    bool needsPrefetch() const;
+
+    /**
+     * Fetches the collections from the server and checks that they can hold
+     * our mimetype. Done once, until invalidateCollections() is called.
+     * Returns false if the first collection is not usable.
+     */
+    bool resolveCollections();
+
   public slots:
-    void slotGetChangesFinished( KJob * );
+    void slotCollectionFetched( KJob * );
     void slotItemsReceived( const Akonadi::Item::List & );
+    void slotCommitJobResult( KJob * );
+    void slotTransactionResult( KJob * );
+
+  signals:
+    /**
+     * Emitted when the metadata fetches of all collections are done.
+     */
+    void collectionsFetched();
+
+    /**
+     * Emitted when commitAll() has nothing left to write.
+     */
+    void commitsFinished();
 
   protected:
     /**
-     * Returns the collection we are supposed to sync with.
+     * Returns the collection new items are added to, the one of the active resource.
      */
     Akonadi::Collection collection() const;
 
     /**
-     * This reports the change back to opensync
-    */
-    void reportChange( const Item& item, const QString& format );
+     * Returns all collections we are supposed to sync with, collection() first.
+     */
+    Akonadi::Collection::List collections() const;
+
+    /**
+     * Returns the opensync uid of an item. Items of the first collection are
+     * known by their remote id, the others are prefixed with their collection id.
+     */
+    QString uid( Akonadi::Collection::Id collection, const QString &remoteId ) const;
+
+    /**
+     * Reports changed and deleted items once all collections have been fetched.
+     */
+    void finishGetChanges();
+
+    /**
+     * Indexes the items of a collection and collects the changed ones.
+     */
+    void processItems( const Akonadi::Item::List &items, Akonadi::Collection::Id collection );
+
+    /**
+     * This reports the change back to opensync. The payload and its fingerprint are
+     * taken from the item unless they are given, e.g. from the conversion cache.
+     */
+    void reportChange( const Item & item, const QString &uid, const QByteArray &payload = QByteArray(),
+                       const QByteArray &fingerprint = QByteArray() );
+
+    /**
+     * Checks the item's hash against the hashtable. Unmodified items are marked as seen.
+     */
+    bool isModified( const Item & item, const QString &uid );
+
+    /**
+     * Fetches the payloads of the changed items in batches and reports them to opensync.
+     */
+    bool reportChangedItems();
+
+    /**
+     * Returns the item count and size of the collections as a string, empty on error.
+     */
+    QString collectionState();
+
+    /**
+     * Compares the current state of the collections with the one stored at the end of the last sync.
+     * Returns false if the last full scan is too many syncs or too long ago.
+     */
+    bool unchangedSinceLastSync();
+
+    /**
+     * Reads and writes the state db of the sink, kept between syncs.
+     */
+    QString state( const char *key );
+    void setState( const char *key, const QString &value );
+
+    /**
+     * Marks every entry of the hashtable not reported yet as seen and unmodified.
+     */
+    void reportAllUnmodified();
+
+    /**
+     * Reports all hashtable entries not seen during getChanges() as deleted,
+     * except those of collections that could not be fetched.
+     */
+    void reportDeletedItems();
+
+    /**
+     * Marks a hashtable entry as seen and unmodified.
+     */
+    void markUnmodified( OSyncHashTable *hashtable, const char *uid );
 
     /**
-     * Reimplement in subclass to provide data about changes to opensync. Note, that you must call DataSink::reportChange( Item, QString, int ) after you have organized data to be send to opensync.
+     * Returns true if the uid belongs to a configured collection resolveCollections() left out.
      */
-    void reportChange( const Item & item );
+    bool isUnavailable( const QString &uid ) const;
+
+    int timeout( SyncMetrics::Phase phase ) const;
+    void phaseFinished( SyncMetrics::Phase phase, int msecs );
 
     /**
      * Creates a new item based on the data given by opensync.
@@ -88,12 +212,58 @@ class DataSink : public SinkBase
 
 
   private:
+    /**
+     * A change queued by commit(), written to akonadi by startCommits().
+     * Its context is finished right away, errors are reported by commitAll().
+     */
+    struct PendingCommit {
+        OSyncChange *change;
+        QString uid;
+        // parsed by commit() for added and modified changes
+        Item item;
+        QString errorText;
+    };
+
+    /**
+     * Starts transactions for the queued changes as long as the commit window allows.
+     */
+    void startCommits();
+    bool prepareCommit( PendingCommit *pending );
+    /**
+     * Fetches the items modified by the next count pending changes in one job.
+     */
+    void fetchCommitTargets( int count );
+    void startChunk( const QList<PendingCommit*> &chunk, const Akonadi::Collection &col );
+    void finishCommit( PendingCommit *pending, const QString &errorText = QString() );
+    bool commitsIdle() const;
+
+    /**
+     * Forgets the prefetched items, the results of running fetches are ignored.
+     */
+    void discardPrefetch();
+    void invalidateCollections();
+    Akonadi::Session *fetchSession( Akonadi::Collection::Id collection );
+    /**
+     * Returns a session no commit transaction runs on.
+     */
+    Akonadi::Session *commitSession();
+
     const Item createAkonadiItem( OSyncChange *change );
-    const Item fetchItem( const QString& id );
-    const Item fetchItem( int id );
+    const Item fetchItem( const QString& uid );
+    const Item fetchItem( Item::Id id );
+    /**
+     * Fills the uid -> Item::Id index from metadata-only fetches of the collections.
+     */
+    bool buildRemoteIdIndex();
     const QString formatName();
-    bool setPayload( Item *item, const QString &str );
     QString getHash(int id, int rev);
+    /**
+     * Appends the fingerprint of the payload to the id and revision,
+     * items whose payload did not change are not reported as modified.
+     */
+    QString getHash(int id, int rev, const QByteArray &fingerprint);
+    static QString revisionPart(const QString &hash);
+    static QString fingerprintPart(const QString &hash);
     int idFromHash(QString hash);
 
 
@@ -103,7 +273,81 @@ class DataSink : public SinkBase
     QString m_Name;
     QString m_Format;
     QString m_MimeType;
-    QString m_Url;
+    // urls of all enabled resources of our objtype, the active one first
+    QStringList m_Urls;
+
+    // metadata fetches of prefetch() still running, and the collection they fetch
+    QHash<KJob*, Akonadi::Collection::Id> m_CollectionFetches;
+    QHash<Akonadi::Collection::Id, Item::List> m_FetchedItems;
+    QString m_FetchError;
+
+    // uid -> Item::Id, valid for the current sync only
+    QHash<QString, Item::Id> m_RemoteIdIndex;
+    bool m_RemoteIdIndexValid;
+
+    // items found modified by the metadata pass of getChanges()
+    Item::List m_ChangedItems;
+    QHash<Item::Id, QString> m_ChangedUids;
+
+    QList<PendingCommit*> m_PendingCommits;
+    // uid -> item of the pending modifications, filled by fetchCommitTargets()
+    QHash<QString, Item> m_CommitTargets;
+    QList< QList<PendingCommit*> > m_RetryChunks;
+    QHash<KJob*, QList<PendingCommit*> > m_CommitJobs;
+    QHash<KJob*, QList<PendingCommit*> > m_Transactions;
+    QHash<KJob*, Akonadi::Session*> m_TransactionSessions;
+    // the sessions of the commit window, created on demand
+    QList<Akonadi::Session*> m_CommitSessions;
+    // start of each transaction, for the metrics and the commit budget
+    QHash<KJob*, QTime> m_TransactionTimes;
+    CommitScheduler m_Scheduler;
+    // set by commitAll(), partial chunks are written as well
+    bool m_Flushing;
+    bool m_Dispatching;
+    // changes that could not be written, reported by commitAll()
+    QStringList m_CommitErrors;
+    // also kept in the state db, the next sync is a slow sync then
+    bool m_CommitFailed;
+
+    // filters the metadata pass of getChanges(), no payload is fetched for skipped items
+    Akonadi::MimeTypeChecker m_MimeTypeChecker;
+    PayloadSerializer m_Serializer;
+    // payload parts fetched for the peer, all of them if empty
+    QList<QByteArray> m_PayloadParts;
+    // m_Format plus the fetch policy, the key of the conversion cache
+    QString m_CacheFormat;
+    // opt-in, serialized payloads of earlier syncs
+    ConversionCache *m_Cache;
+    int m_ReceivedItems;
+    int m_SkippedItems;
+
+    // opt-in, skip getChanges() when the collection state did not change
+    bool m_SkipUnchanged;
+    QString m_CollectionState;
+    // the count and size miss edits that keep the size, so every so often we scan anyway
+    int m_SkipUnchangedMaxSyncs;
+    int m_SkippedSyncs;
+    bool m_Skipping;
+    int m_CommittedChanges;
+
+    // the collection of the active resource, its items keep their remote id as uid
+    Akonadi::Collection::Id m_PrimaryCollection;
+
+    Akonadi::Session *m_Session;
+    // further collections are fetched on sessions of their own
+    QHash<Akonadi::Collection::Id, Akonadi::Session*> m_FetchSessions;
+    bool m_Prefetching;
+
+    // the collections as fetched by resolveCollections(), collection() first
+    Akonadi::Collection::List m_Collections;
+    bool m_CollectionsResolved;
+    // uid prefixes of the configured collections that are gone or unusable
+    QStringList m_UnavailablePrefixes;
+    // the collection tree cached by discover
+    QString m_CollectionTreeCache;
+
+    // timeouts from the throughput of earlier syncs
+    TimeoutBudget *m_Budget;
 
 };
 
@@ -0,0 +1,319 @@
+/*
+    Copyright (c) 2026 Emanoil Kotsev <deloptes@yahoo.com>
+
+    $Id$
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#include "payloadserializer.h"
+#include "synctrace.h"
+
+// calendar includes
+#include <kcal/attachment.h>
+#include <kcal/calendarlocal.h>
+#include <kcal/incidence.h>
+#include <kcal/icalformat.h>
+#include <kcal/vcalformat.h>
+
+// contact includes
+#include <kabc/addressee.h>
+#include <kabc/vcardconverter.h>
+
+#include <KDebug>
+
+#include <QTime>
+
+#include <opensync/opensync.h>
+
+#include <glib.h>
+#include <string.h>
+
+#include <boost/shared_ptr.hpp>
+
+using namespace Akonadi;
+
+typedef boost::shared_ptr<KCal::Incidence> IncidencePtr;
+
+static const char *pathNames[PayloadSerializer::PathCount] = { "passthrough", "vcard21", "vcalendar10" };
+
+PayloadSerializer::PayloadSerializer() :
+        m_Path( Passthrough ),
+        m_MaxInlineSize( 0 )
+{
+    resetStatistics();
+}
+
+void PayloadSerializer::setFormat( const QString &mimeType, const QString &objformat )
+{
+    m_MimeType = mimeType;
+    m_Format = objformat;
+
+    // akonadi stores contacts as vCard 3.0 and incidences as iCalendar 2.0
+    if ( objformat == "vcard21" )
+        m_Path = VCard21;
+    else if ( objformat == "vevent10" || objformat == "vtodo10" )
+        m_Path = VCalendar10;
+    else
+        m_Path = Passthrough;
+
+    kDebug() << mimeType << "->" << objformat << ":" << pathNames[m_Path];
+}
+
+void PayloadSerializer::setMaxInlineSize( int bytes )
+{
+    m_MaxInlineSize = qMax( bytes, 0 );
+}
+
+bool PayloadSerializer::stripLargeBinaries( Item *item ) const
+{
+    bool stripped = false;
+
+    if ( item->hasPayload<KABC::Addressee>() ) {
+        KABC::Addressee addressee = item->payload<KABC::Addressee>();
+        // pictures kept by url are references already, the decoded size
+        // is an upper bound of what the vCard would carry
+        if ( addressee.photo().isIntern() && addressee.photo().data().byteCount() > m_MaxInlineSize ) {
+            addressee.setPhoto( KABC::Picture() );
+            stripped = true;
+        }
+        if ( addressee.logo().isIntern() && addressee.logo().data().byteCount() > m_MaxInlineSize ) {
+            addressee.setLogo( KABC::Picture() );
+            stripped = true;
+        }
+        if ( addressee.sound().isIntern() && addressee.sound().data().size() > m_MaxInlineSize ) {
+            addressee.setSound( KABC::Sound() );
+            stripped = true;
+        }
+        if ( stripped )
+            item->setPayload<KABC::Addressee>( addressee );
+        return stripped;
+    }
+
+    if ( item->hasPayload<IncidencePtr>() ) {
+        const IncidencePtr incidence = item->payload<IncidencePtr>();
+        KCal::Attachment::List large;
+        foreach ( KCal::Attachment *attachment, incidence->attachments() )
+            if ( attachment->isBinary() && int( attachment->size() ) > m_MaxInlineSize )
+                large.append( attachment );
+        if ( large.isEmpty() )
+            return false;
+
+        // the payload is shared with the item we got from akonadi
+        IncidencePtr copy( incidence->clone() );
+        foreach ( KCal::Attachment *attachment, copy->attachments() )
+            if ( attachment->isBinary() && int( attachment->size() ) > m_MaxInlineSize )
+                copy->deleteAttachment( attachment );
+        item->setPayload<IncidencePtr>( copy );
+        return true;
+    }
+
+    return false;
+}
+
+QByteArray PayloadSerializer::serialize( const Item &original )
+{
+    QTime time;
+    time.start();
+
+    Item item = original;
+    if ( m_MaxInlineSize > 0 && stripLargeBinaries( &item ) )
+        SYNC_TRACE( 2, BinariesStripped, item.id(), 0 );
+
+    QByteArray data;
+    switch ( m_Path )
+    {
+    case Passthrough:
+        // payloadData() serializes the payload on every call, so ask only once
+        data = item.payloadData();
+        break;
+    case VCard21:
+    {
+        if ( !item.hasPayload<KABC::Addressee>() )
+            return QByteArray();
+        KABC::VCardConverter converter;
+        data = converter.createVCard( item.payload<KABC::Addressee>(), KABC::VCardConverter::v2_1 );
+        break;
+    }
+    case VCalendar10:
+    {
+        if ( !item.hasPayload<IncidencePtr>() )
+            return QByteArray();
+        KCal::CalendarLocal calendar( KDateTime::UTC );
+        // the calendar takes ownership
+        calendar.addIncidence( item.payload<IncidencePtr>()->clone() );
+        KCal::VCalFormat format;
+        data = format.toString( &calendar ).toUtf8();
+        break;
+    }
+    default:
+        return QByteArray();
+    }
+
+    ++m_Items[m_Path];
+    m_Bytes[m_Path] += data.size();
+    m_Msecs[m_Path] += time.elapsed();
+    return data;
+}
+
+bool PayloadSerializer::deserialize( Item *item, const QByteArray &data ) const
+{
+    item->setMimeType( m_MimeType );
+
+    if ( m_MimeType == "text/directory" ) {
+        // handles both 2.1 and 3.0
+        KABC::VCardConverter converter;
+        KABC::Addressee vcard = converter.parseVCard( data );
+        if ( vcard.isEmpty() )
+            return false;
+        item->setPayload<KABC::Addressee>( vcard );
+        return true;
+    }
+
+    if ( m_Path == VCalendar10 ) {
+        KCal::CalendarLocal calendar( KDateTime::UTC );
+        KCal::VCalFormat format;
+        if ( !format.fromString( &calendar, QString::fromUtf8( data ) ) )
+            return false;
+        KCal::Incidence::List incidences = calendar.incidences();
+        if ( incidences.isEmpty() )
+            return false;
+        item->setPayload<IncidencePtr>( IncidencePtr( incidences.first()->clone() ) );
+        return true;
+    }
+
+    // fromString() hands us a copy we own
+    KCal::ICalFormat format;
+    KCal::Incidence *incidence = format.fromString( QString::fromUtf8( data ) );
+    if ( !incidence )
+        return false;
+    item->setPayload<IncidencePtr>( IncidencePtr( incidence ) );
+    return true;
+}
+
+bool PayloadSerializer::restoreLargeBinaries( Item *item, const Item &stored ) const
+{
+    if ( m_MaxInlineSize <= 0 )
+        return false;
+
+    bool restored = false;
+
+    if ( item->hasPayload<KABC::Addressee>() && stored.hasPayload<KABC::Addressee>() ) {
+        KABC::Addressee addressee = item->payload<KABC::Addressee>();
+        const KABC::Addressee original = stored.payload<KABC::Addressee>();
+        // smaller ones were sent, if they are missing the peer removed them
+        if ( addressee.photo().isEmpty() && original.photo().isIntern()
+             && original.photo().data().byteCount() > m_MaxInlineSize ) {
+            addressee.setPhoto( original.photo() );
+            restored = true;
+        }
+        if ( addressee.logo().isEmpty() && original.logo().isIntern()
+             && original.logo().data().byteCount() > m_MaxInlineSize ) {
+            addressee.setLogo( original.logo() );
+            restored = true;
+        }
+        if ( addressee.sound().isEmpty() && original.sound().isIntern()
+             && original.sound().data().size() > m_MaxInlineSize ) {
+            addressee.setSound( original.sound() );
+            restored = true;
+        }
+        if ( restored )
+            item->setPayload<KABC::Addressee>( addressee );
+        return restored;
+    }
+
+    if ( item->hasPayload<IncidencePtr>() && stored.hasPayload<IncidencePtr>() ) {
+        // parsed by deserialize(), the payload is not shared
+        const IncidencePtr incidence = item->payload<IncidencePtr>();
+        foreach ( KCal::Attachment *attachment, stored.payload<IncidencePtr>()->attachments() ) {
+            if ( attachment->isBinary() && int( attachment->size() ) > m_MaxInlineSize ) {
+                incidence->addAttachment( new KCal::Attachment( *attachment ) );
+                restored = true;
+            }
+        }
+        return restored;
+    }
+
+    return false;
+}
+
+QByteArray PayloadSerializer::fingerprint( const Item &item ) const
+{
+    if ( !item.hasPayload() )
+        return QByteArray();
+
+    // the calendar serializer stamps every serialization with the current time
+    const QByteArray data = item.payloadData();
+    QByteArray stable;
+    stable.reserve( data.size() );
+    int start = 0;
+    while ( start < data.size() ) {
+        int end = data.indexOf( '\n', start );
+        end = ( end < 0 ) ? data.size() : end + 1;
+        if ( qstrncmp( data.constData() + start, "DTSTAMP", 7 ) != 0 )
+            stable.append( data.constData() + start, end - start );
+        start = end;
+    }
+    return fingerprint( stable );
+}
+
+QByteArray PayloadSerializer::fingerprint( const QByteArray &data )
+{
+    // 64 bit FNV-1a, fast and good enough to tell edits apart
+    quint64 h = Q_UINT64_C( 14695981039346656037 );
+    const char *bytes = data.constData();
+    for ( int i = 0; i < data.size(); ++i ) {
+        h ^= quint8( bytes[i] );
+        h *= Q_UINT64_C( 1099511628211 );
+    }
+    QByteArray hash( 8, '\0' );
+    for ( int i = 0; i < 8; ++i )
+        hash[i] = char( h >> ( 56 - 8 * i ) );
+    // 11 characters instead of 16 hex digits
+    QByteArray encoded = hash.toBase64();
+    encoded.chop( 1 );
+    return encoded;
+}
+
+char *PayloadSerializer::toOSyncBuffer( const QByteArray &data )
+{
+    // g_strndup() would cut the payload at its first NUL
+    char *buffer = static_cast<char*>( g_malloc( data.size() + 1 ) );
+    memcpy( buffer, data.constData(), data.size() );
+    buffer[data.size()] = '\0';
+    return buffer;
+}
+
+void PayloadSerializer::reportStatistics( const QString &name ) const
+{
+    for ( int i = 0; i < PathCount; ++i ) {
+        if ( !m_Items[i] )
+            continue;
+        kDebug() << name << pathNames[i] << ":" << m_Items[i] << "items," << m_Bytes[i] << "bytes,"
+                 << m_Msecs[i] << "ms," << double( m_Msecs[i] ) / m_Items[i] << "ms per item";
+        osync_trace( TRACE_INTERNAL, "%s: %s serialized %d items, %lld bytes in %d ms", name.toLatin1().data(),
+                     pathNames[i], m_Items[i], (long long) m_Bytes[i], m_Msecs[i] );
+    }
+}
+
+void PayloadSerializer::resetStatistics()
+{
+    for ( int i = 0; i < PathCount; ++i ) {
+        m_Items[i] = 0;
+        m_Bytes[i] = 0;
+        m_Msecs[i] = 0;
+    }
+}
@@ -0,0 +1,124 @@
+/*
+    Copyright (c) 2026 Emanoil Kotsev <deloptes@yahoo.com>
+
+    $Id$
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#ifndef PAYLOADSERIALIZER_H
+#define PAYLOADSERIALIZER_H
+
+#include <QByteArray>
+#include <QString>
+
+#include <akonadi/item.h>
+
+/**
+ * Converts between Akonadi payloads and the objformat negotiated with opensync.
+ *
+ * If Akonadi's own serialization already is the objformat (vcard30,
+ * vevent20, vtodo20, vjournal) the payload data is passed through as it
+ * is, otherwise the payload is converted with KABC or KCal.
+ *
+ * Embedded binaries larger than the inline limit, contact pictures and
+ * sounds or attachments of incidences, are left out of the serialization.
+ */
+class PayloadSerializer
+{
+  public:
+    enum Path {
+        Passthrough = 0,
+        VCard21,
+        VCalendar10,
+        PathCount
+    };
+
+    PayloadSerializer();
+
+    void setFormat( const QString &mimeType, const QString &objformat );
+
+    /**
+     * Sets the largest embedded binary in bytes that is passed on, 0 for no limit.
+     */
+    void setMaxInlineSize( int bytes );
+
+    int maxInlineSize() const {
+        return m_MaxInlineSize;
+    }
+
+    Path path() const {
+        return m_Path;
+    }
+
+    /**
+     * Returns the item's payload in the objformat, empty if it can not be converted.
+     */
+    QByteArray serialize( const Akonadi::Item &item );
+
+    /**
+     * Parses data in the objformat into the item's payload.
+     */
+    bool deserialize( Akonadi::Item *item, const QByteArray &data ) const;
+
+    /**
+     * Puts the binaries that serialize() left out of what the peer got back
+     * into a change the peer sent for the stored item.
+     * Returns false if there were none, the item is not touched then.
+     */
+    bool restoreLargeBinaries( Akonadi::Item *item, const Akonadi::Item &stored ) const;
+
+    /**
+     * Returns a fingerprint of the item's payload as Akonadi stores it, the
+     * same for any objformat and inline limit, empty without a payload.
+     */
+    QByteArray fingerprint( const Akonadi::Item &item ) const;
+
+    /**
+     * Returns a short hash of the data, 11 characters of base64.
+     */
+    static QByteArray fingerprint( const QByteArray &data );
+
+    /**
+     * Returns the data in a buffer for osync_data_new(), which takes it over
+     * and g_free()s it. Embedded NULs are kept, a NUL is appended.
+     */
+    static char *toOSyncBuffer( const QByteArray &data );
+
+    /**
+     * Writes the number of items, bytes and time spent per path to the debug output and trace.
+     */
+    void reportStatistics( const QString &name ) const;
+    void resetStatistics();
+
+  private:
+    /**
+     * Removes the binaries above the inline limit from the item's payload.
+     * Returns false if there were none, the item is not touched then.
+     */
+    bool stripLargeBinaries( Akonadi::Item *item ) const;
+
+    QString m_MimeType;
+    QString m_Format;
+    Path m_Path;
+    int m_MaxInlineSize;
+
+    int m_Items[PathCount];
+    qint64 m_Bytes[PathCount];
+    int m_Msecs[PathCount];
+};
+
+#endif
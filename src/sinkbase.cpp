@@ -21,8 +21,12 @@
 */
 
 #include "sinkbase.h"
+#include "syncmetrics.h"
+#include "synctrace.h"
 #include <KDebug>
 
+#include <QTime>
+
 #define WRAP() \
   osync_trace( TRACE_ENTRY, "%s(%p,%p, %p, %p)", __PRETTY_FUNCTION__, sink, info, ctx, userdata); \
   kDebug() << osync_objtype_sink_get_name( sink );\
@@ -31,18 +35,44 @@
   sb->setPluginInfo( info );\
   sb->setContext( ctx );
 
+/**
+ * Hands the time spent in a callback to the sink when it goes out of scope.
+ */
+class CallTimer
+{
+  public:
+    CallTimer( SinkBase *sink, SyncMetrics::Phase phase ) :
+            m_Sink( sink ),
+            m_Phase( phase )
+    {
+        m_Time.start();
+    }
+
+    ~CallTimer()
+    {
+        m_Sink->callFinished( m_Phase, m_Time.elapsed() );
+    }
+
+  private:
+    SinkBase *m_Sink;
+    SyncMetrics::Phase m_Phase;
+    QTime m_Time;
+};
+
 extern "C"
 {
 
     static void connect_wrapper(OSyncObjTypeSink *sink, OSyncPluginInfo *info, OSyncContext *ctx, void *userdata )
     {
         WRAP( )
+        CallTimer timer( sb, SyncMetrics::Connect );
         sb->connect();
         osync_trace( TRACE_EXIT, "%s", __PRETTY_FUNCTION__ );
     }
 
     static void disconnect_wrapper(OSyncObjTypeSink *sink, OSyncPluginInfo *info, OSyncContext *ctx, void *userdata) {
         WRAP( )
+        CallTimer timer( sb, SyncMetrics::Disconnect );
         sb->disconnect();
 	osync_objtype_sink_unref(sink); //needed?
         osync_trace( TRACE_EXIT, "%s", __PRETTY_FUNCTION__ );
@@ -52,28 +82,37 @@ extern "C"
 
         WRAP ( )
         sb->setSlowSink(slow_sync);
+        CallTimer timer( sb, SyncMetrics::GetChanges );
         sb->getChanges();
         osync_trace( TRACE_EXIT, "%s", __PRETTY_FUNCTION__ );
     }
 
     static void sync_done_wrapper(OSyncObjTypeSink *sink, OSyncPluginInfo *info, OSyncContext *ctx, void *userdata) {
         WRAP( )
-        sb->syncDone();
+        {
+            CallTimer timer( sb, SyncMetrics::SyncDone );
+            sb->syncDone();
+        }
+        // the summary covers the sync_done call as well
+        if ( sb->metrics() )
+            sb->metrics()->report( osync_objtype_sink_get_name( sink ) );
         osync_trace( TRACE_EXIT, "%s", __PRETTY_FUNCTION__ );
     }
 
     static void commit_wrapper(OSyncObjTypeSink *sink, OSyncPluginInfo *info, OSyncContext *ctx,  OSyncChange *change, void *userdata) {
         WRAP( )
+        CallTimer timer( sb, SyncMetrics::Commit );
         sb->commit(change);
         osync_trace( TRACE_EXIT, "%s", __PRETTY_FUNCTION__ );
     }
 
-//     static void commitAll_wrapper(OSyncObjTypeSink *sink, OSyncPluginInfo *info, OSyncContext *ctx,  void *userdata) {
-//         WRAP(  )
-//         sb->commitAll();
-//         osync_trace( TRACE_EXIT, "%s", __PRETTY_FUNCTION__ );
-//     }
-// 
+    static void commitAll_wrapper(OSyncObjTypeSink *sink, OSyncPluginInfo *info, OSyncContext *ctx,  void *userdata) {
+        WRAP(  )
+        CallTimer timer( sb, SyncMetrics::CommitAll );
+        sb->commitAll();
+        osync_trace( TRACE_EXIT, "%s", __PRETTY_FUNCTION__ );
+    }
+
 //     static void read_wrapper(OSyncObjTypeSink *sink, OSyncPluginInfo *info, OSyncContext *ctx,  OSyncChange *change, void *userdata) {
 //         WRAP(  )
 //         sb->commit(change);
@@ -102,7 +141,8 @@ SinkBase::SinkBase( int features ) :
         m_canRead      (false),
         m_canSyncDone  (false),
         m_canBatchCommit(false),
-        m_SlowSync     (false)
+        m_SlowSync     (false),
+        m_Metrics      (0)
 {
 
     m_canConnect    = ( features & Connect ) ? true : false;
@@ -123,6 +163,7 @@ SinkBase::~SinkBase()
 //         osync_context_unref(mContext);
     if ( mSink )
         osync_objtype_sink_unref( mSink );
+    delete m_Metrics;
 //     if (mPluginInfo)
 //         osync_plugin_info_unref(mPluginInfo);
 }
@@ -144,6 +185,31 @@ osync_bool SinkBase::getSlowSink()
     return m_SlowSync;
 }
 
+void SinkBase::callFinished( SyncMetrics::Phase phase, int msecs )
+{
+    if ( m_Metrics )
+        m_Metrics->addTime( phase, msecs );
+    phaseFinished( phase, msecs );
+}
+
+int SinkBase::timeout( SyncMetrics::Phase phase ) const
+{
+    Q_UNUSED( phase );
+    return 15;
+}
+
+void SinkBase::phaseFinished( SyncMetrics::Phase phase, int msecs )
+{
+    Q_UNUSED( phase );
+    Q_UNUSED( msecs );
+}
+
+void SinkBase::setMetrics( SyncMetrics *metrics )
+{
+    delete m_Metrics;
+    m_Metrics = metrics;
+}
+
 void SinkBase::disconnect()
 {
   kDebug();
@@ -163,11 +229,12 @@ void SinkBase::commit(OSyncChange * chg)
     Q_ASSERT( false );
 }
 
-// void SinkBase::commitAll()
-// {
-//     Q_ASSERT( false );
-// }
-// 
+void SinkBase::commitAll()
+{
+  kDebug();
+    Q_ASSERT( false );
+}
+
 // void SinkBase::write()
 // {
 //     Q_ASSERT( false );
@@ -197,6 +264,7 @@ void SinkBase::error(OSyncErrorType type, QString msg) const
 {
     kDebug();
     Q_ASSERT( mContext );
+    SyncTrace::dump();
     OSyncError *oerror;
     osync_error_set(&oerror, type, "%s", msg.toUtf8().data() );
     osync_context_report_osyncerror(mContext, oerror );
@@ -232,27 +300,27 @@ void SinkBase::wrapSink(OSyncObjTypeSink* sink)
 
     if ( m_canConnect ) {
         osync_objtype_sink_set_connect_func(sink, connect_wrapper);
-        osync_objtype_sink_set_connect_timeout(sink, 15);
+        osync_objtype_sink_set_connect_timeout(sink, timeout( SyncMetrics::Connect ));
     }
     if ( m_canDisconnect ) {
         osync_objtype_sink_set_disconnect_func(sink, disconnect_wrapper);
-        osync_objtype_sink_set_disconnect_timeout(sink, 15);
+        osync_objtype_sink_set_disconnect_timeout(sink, timeout( SyncMetrics::Disconnect ));
     }
     if ( m_canGetChanges ) {
         osync_objtype_sink_set_get_changes_func(sink, get_changes_wrapper);
-        osync_objtype_sink_set_getchanges_timeout(sink, 15);
+        osync_objtype_sink_set_getchanges_timeout(sink, timeout( SyncMetrics::GetChanges ));
     }
     if ( m_canCommit ) {
         osync_objtype_sink_set_commit_func(sink, commit_wrapper);
-        osync_objtype_sink_set_commit_timeout(sink, 15);
+        osync_objtype_sink_set_commit_timeout(sink, timeout( SyncMetrics::Commit ));
+    }
+    if ( m_canCommitAll ) {
+        osync_objtype_sink_set_committed_all_func(sink, commitAll_wrapper);
+        osync_objtype_sink_set_committedall_timeout(sink, timeout( SyncMetrics::CommitAll ));
     }
-//     if ( m_canCommitAll ) {
-//         osync_objtype_sink_set_committed_all_func(sink, commitAll_wrapper);
-//         osync_objtype_sink_set_committedall_timeout(sink, 15);
-//     }
     if ( m_canSyncDone ) {
         osync_objtype_sink_set_sync_done_func(sink, sync_done_wrapper);
-        osync_objtype_sink_set_syncdone_timeout(sink, 15);
+        osync_objtype_sink_set_syncdone_timeout(sink, timeout( SyncMetrics::SyncDone ));
     }
 //   TODO: check if relevant for akonadi
 //   if ( m_canWrite )
@@ -23,6 +23,8 @@
 #ifndef SINKBASE_H
 #define SINKBASE_H
 
+#include "syncmetrics.h"
+
 #include <QObject>
 
 #include <opensync/opensync.h>
@@ -58,7 +60,7 @@ public:
     virtual void commit( OSyncChange *chg );
 //     virtual void write();
 //     virtual void read();
-//     virtual void commitAll();
+    virtual void commitAll();
     virtual void syncDone();
 
     OSyncContext* context() const {
@@ -69,17 +71,41 @@ public:
         return mPluginInfo;
     }
     osync_bool getSlowSink ();
+
+    /**
+     * Returns the metrics of the current sync, 0 if they are disabled.
+     */
+    SyncMetrics *metrics() const {
+        return m_Metrics;
+    }
     
     void setPluginInfo( OSyncPluginInfo *info );
     void setContext( OSyncContext *context );
     void setSink( OSyncObjTypeSink *sink);
     void setSlowSink (osync_bool);
+    /**
+     * Enables metrics, the sink takes ownership.
+     */
+    void setMetrics( SyncMetrics *metrics );
+
+    /**
+     * Called by the wrappers after each callback with the time it took.
+     */
+    void callFinished( SyncMetrics::Phase phase, int msecs );
 
 protected:
     void success() const;
     void error(OSyncErrorType type, QString msg) const;
     void warning( OSyncError *error ) const;
     void wrapSink(OSyncObjTypeSink* sink );
+    /**
+     * Returns the timeout of a callback in seconds, taken by wrapSink().
+     */
+    virtual int timeout( SyncMetrics::Phase phase ) const;
+    /**
+     * Called after each callback, the context may still be pending.
+     */
+    virtual void phaseFinished( SyncMetrics::Phase phase, int msecs );
     OSyncObjTypeSink* sink() const {
         return mSink;
     }
@@ -94,6 +120,7 @@ private:
     m_canGetChanges, m_canWrite, m_canRead, m_canSyncDone, m_canBatchCommit;
 //  unused   bool  m_canCommitRead;
     osync_bool m_SlowSync;
+    SyncMetrics *m_Metrics;
 };
 
 #endif //End of SINKBASE_H
\ No newline at end of file
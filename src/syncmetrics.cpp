@@ -0,0 +1,112 @@
+/*
+    Copyright (c) 2026 Emanoil Kotsev <deloptes@yahoo.com>
+
+    $Id$
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#include "syncmetrics.h"
+
+#include <KDebug>
+
+#include <QDateTime>
+#include <QFile>
+
+#include <opensync/opensync.h>
+
+static const char *counterNames[SyncMetrics::CounterCount] = {
+    "items_fetched", "bytes_fetched", "items_skipped", "unmodified_skipped",
+    "added_reported", "modified_reported", "deleted_reported", "bytes_reported",
+    "added_committed", "modified_committed", "deleted_committed", "commit_errors", "bytes_committed"
+};
+
+static const char *phaseNames[SyncMetrics::PhaseCount] = {
+    "connect", "disconnect", "get_changes", "commit", "committed_all", "sync_done"
+};
+
+static const int latencyBounds[SyncMetrics::LatencyBucketCount - 1] = { 10, 50, 100, 500, 1000, 5000 };
+
+SyncMetrics::SyncMetrics( const QString &fileName ) :
+        m_FileName( fileName )
+{
+    reset();
+}
+
+void SyncMetrics::addCommitLatency( int msecs )
+{
+    int bucket = 0;
+    while ( bucket < LatencyBucketCount - 1 && msecs >= latencyBounds[bucket] )
+        ++bucket;
+    ++m_Latency[bucket];
+}
+
+QByteArray SyncMetrics::toJson( const QString &name ) const
+{
+    QByteArray json = "{\"sink\":\"" + name.toUtf8() + "\",\"time\":\""
+                      + QDateTime::currentDateTime().toString( Qt::ISODate ).toLatin1() + '"';
+
+    for ( int i = 0; i < CounterCount; ++i )
+        json += ",\"" + QByteArray( counterNames[i] ) + "\":" + QByteArray::number( m_Counters[i] );
+
+    json += ",\"phases\":{";
+    for ( int i = 0; i < PhaseCount; ++i ) {
+        if ( i )
+            json += ',';
+        json += '"' + QByteArray( phaseNames[i] ) + "\":{\"calls\":" + QByteArray::number( m_Calls[i] )
+                + ",\"ms\":" + QByteArray::number( m_Msecs[i] ) + '}';
+    }
+
+    // keys are the upper bounds of the buckets
+    json += "},\"commit_latency_ms\":{";
+    for ( int i = 0; i < LatencyBucketCount; ++i ) {
+        if ( i )
+            json += ',';
+        json += '"' + ( i < LatencyBucketCount - 1 ? QByteArray::number( latencyBounds[i] ) : QByteArray( "inf" ) )
+                + "\":" + QByteArray::number( m_Latency[i] );
+    }
+    json += "}}";
+
+    return json;
+}
+
+void SyncMetrics::report( const QString &name )
+{
+    const QByteArray json = toJson( name );
+    osync_trace( TRACE_INTERNAL, "%s: metrics %s", name.toLatin1().data(), json.data() );
+
+    if ( !m_FileName.isEmpty() ) {
+        QFile file( m_FileName );
+        if ( file.open( QIODevice::WriteOnly | QIODevice::Append ) )
+            file.write( json + '\n' );
+        else
+            kDebug() << "unable to write metrics to" << m_FileName << file.errorString();
+    }
+
+    reset();
+}
+
+void SyncMetrics::reset()
+{
+    for ( int i = 0; i < CounterCount; ++i )
+        m_Counters[i] = 0;
+    for ( int i = 0; i < PhaseCount; ++i ) {
+        m_Calls[i] = 0;
+        m_Msecs[i] = 0;
+    }
+    for ( int i = 0; i < LatencyBucketCount; ++i )
+        m_Latency[i] = 0;
+}
@@ -0,0 +1,103 @@
+/*
+    Copyright (c) 2026 Emanoil Kotsev <deloptes@yahoo.com>
+
+    $Id$
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#ifndef SYNCMETRICS_H
+#define SYNCMETRICS_H
+
+#include <QByteArray>
+#include <QString>
+
+/**
+ * Counters and timings of one sink during one sync.
+ *
+ * Sinks only have an instance if metrics are enabled in the configuration,
+ * so every call site checks for a null pointer and nothing else.
+ */
+class SyncMetrics
+{
+  public:
+    enum Counter {
+        ItemsFetched = 0,
+        BytesFetched,
+        ItemsSkipped,
+        UnmodifiedSkipped,
+        AddedReported,
+        ModifiedReported,
+        DeletedReported,
+        BytesReported,
+        AddedCommitted,
+        ModifiedCommitted,
+        DeletedCommitted,
+        CommitErrors,
+        BytesCommitted,
+        CounterCount
+    };
+
+    enum Phase {
+        Connect = 0,
+        Disconnect,
+        GetChanges,
+        Commit,
+        CommitAll,
+        SyncDone,
+        PhaseCount
+    };
+
+    // upper bounds in ms of the commit latency buckets, the last one is open
+    enum { LatencyBucketCount = 7 };
+
+    /**
+     * The summary is appended to fileName as one JSON object per line,
+     * it only goes to the trace if fileName is empty.
+     */
+    explicit SyncMetrics( const QString &fileName = QString() );
+
+    void add( Counter counter, qint64 value = 1 ) {
+        m_Counters[counter] += value;
+    }
+
+    void addTime( Phase phase, int msecs ) {
+        ++m_Calls[phase];
+        m_Msecs[phase] += msecs;
+    }
+
+    void addCommitLatency( int msecs );
+
+    /**
+     * Returns the summary as a JSON object.
+     */
+    QByteArray toJson( const QString &name ) const;
+
+    /**
+     * Writes the summary to the trace and the file, and starts over.
+     */
+    void report( const QString &name );
+    void reset();
+
+  private:
+    QString m_FileName;
+    qint64 m_Counters[CounterCount];
+    int m_Calls[PhaseCount];
+    qint64 m_Msecs[PhaseCount];
+    int m_Latency[LatencyBucketCount];
+};
+
+#endif
@@ -0,0 +1,121 @@
+/*
+    Copyright (c) 2026 Emanoil Kotsev <deloptes@yahoo.com>
+
+    $Id$
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#include "synctrace.h"
+
+#include <KDebug>
+
+#include <QAtomicInt>
+#include <QFile>
+#include <QTextStream>
+
+#include <time.h>
+
+// a power of two, so that the wrapping counter stays a valid index
+static const int BufferSize = 8192;
+
+struct TraceEvent {
+    qint64 usecs;
+    qint64 a;
+    qint64 b;
+    int event;
+};
+
+static TraceEvent buffer[BufferSize];
+static QAtomicInt next;
+static QString dumpFile;
+
+// format of each event, %1 and %2 are the arguments
+static const char *eventFormats[SyncTrace::EventCount] = {
+    "getChanges started, slow sync %1",
+    "%1 items received, %2 collections",
+    "%1 payloads fetched, %2 left",
+    "%1 items reported deleted",
+    "chunk of %1 changes started, %2 in flight",
+    "transaction of %1 changes finished, error %2",
+    "item %1 reported, changetype %2",
+    "item %1 unmodified, revision %2",
+    "item %1 from conversion cache, revision %2",
+    "change queued, changetype %1, %2 bytes",
+    "item %1 committed, changetype %2",
+    "item %1 serialized without its large binaries",
+    "item %1 kept its large binaries"
+};
+
+static qint64 now()
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return qint64( ts.tv_sec ) * 1000000 + ts.tv_nsec / 1000;
+}
+
+void SyncTrace::record( Event event, qint64 a, qint64 b )
+{
+    TraceEvent &e = buffer[ next.fetchAndAddRelaxed( 1 ) & ( BufferSize - 1 ) ];
+    e.usecs = now();
+    e.a = a;
+    e.b = b;
+    e.event = event;
+}
+
+QStringList SyncTrace::decode()
+{
+    QStringList lines;
+    // unsigned, so that a wrapped counter still gives the right distance
+    const uint end = int( next );
+    const uint count = qMin( end, uint( BufferSize ) );
+
+    // an event recorded while decoding may show up out of order, that is fine for a trace
+    qint64 first = -1;
+    for ( uint i = end - count; i != end; ++i ) {
+        const TraceEvent &e = buffer[ i & ( BufferSize - 1 ) ];
+        if ( e.event < 0 || e.event >= EventCount )
+            continue;
+        if ( first < 0 )
+            first = e.usecs;
+        QString text = QString( eventFormats[e.event] ).arg( e.a );
+        if ( text.contains( "%2" ) )
+            text = text.arg( e.b );
+        lines << QString( "%1 us: " ).arg( e.usecs - first, 10 ) + text;
+    }
+    return lines;
+}
+
+void SyncTrace::setDumpFile( const QString &fileName )
+{
+    dumpFile = fileName;
+}
+
+void SyncTrace::dump()
+{
+    if ( dumpFile.isEmpty() )
+        return;
+
+    QFile file( dumpFile );
+    if ( !file.open( QIODevice::WriteOnly | QIODevice::Truncate ) ) {
+        kDebug() << "unable to write trace to" << dumpFile << file.errorString();
+        return;
+    }
+
+    QTextStream stream( &file );
+    foreach ( const QString &line, decode() )
+        stream << line << '\n';
+}
@@ -0,0 +1,89 @@
+/*
+    Copyright (c) 2026 Emanoil Kotsev <deloptes@yahoo.com>
+
+    $Id$
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#ifndef SYNCTRACE_H
+#define SYNCTRACE_H
+
+#include <QString>
+#include <QStringList>
+
+/**
+ * Events of the per-item trace levels above 1 are compiled out if this is lowered,
+ * 0 removes the trace completely.
+ */
+#ifndef SYNCTRACE_LEVEL
+#define SYNCTRACE_LEVEL 2
+#endif
+
+/**
+ * Records an event with two numeric arguments into the ring buffer.
+ * Nothing is formatted here, see SyncTrace::decode().
+ */
+#define SYNC_TRACE( level, event, a, b ) \
+    do { if ( (level) <= SYNCTRACE_LEVEL ) SyncTrace::record( SyncTrace::event, (a), (b) ); } while ( 0 )
+
+/**
+ * Binary trace of the hot paths, cheap enough to stay enabled.
+ *
+ * Events go into a fixed size ring buffer shared by all sinks, only the
+ * most recent ones are kept. The buffer is turned into text on demand,
+ * e.g. when a sink reports an error.
+ */
+namespace SyncTrace
+{
+    enum Event {
+        // level 1, once per phase or batch
+        GetChangesStarted = 0,
+        ItemsReceived,
+        PayloadBatchFetched,
+        DeletedReported,
+        ChunkStarted,
+        TransactionFinished,
+        // level 2, once per item
+        ChangeReported,
+        UnmodifiedSkipped,
+        CacheHit,
+        ChangeQueued,
+        ChangeCommitted,
+        BinariesStripped,
+        BinariesRestored,
+        EventCount
+    };
+
+    void record( Event event, qint64 a, qint64 b );
+
+    /**
+     * Returns the recorded events, oldest first, one line each.
+     */
+    QStringList decode();
+
+    /**
+     * Sets the file dump() writes to, nothing is written without one.
+     */
+    void setDumpFile( const QString &fileName );
+
+    /**
+     * Writes decode() to the dump file, replacing an older dump.
+     */
+    void dump();
+}
+
+#endif
@@ -0,0 +1,100 @@
+/*
+    Copyright (c) 2026 Emanoil Kotsev <deloptes@yahoo.com>
+
+    $Id$
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+
+#include "commitscheduler.h"
+
+#include <qtest_kde.h>
+
+class CommitSchedulerTest : public QObject
+{
+    Q_OBJECT
+
+  private slots:
+    void testPartialChunk()
+    {
+        CommitScheduler scheduler( 200, 16 );
+        QCOMPARE( scheduler.nextChunkSize( 0, false ), 0 );
+        QCOMPARE( scheduler.nextChunkSize( 199, false ), 0 );
+        QCOMPARE( scheduler.nextChunkSize( 199, true ), 199 );
+        QCOMPARE( scheduler.nextChunkSize( 450, false ), 200 );
+        QCOMPARE( scheduler.nextChunkSize( 0, true ), 0 );
+    }
+
+    void testWindowLargerThanBatch()
+    {
+        // 25 changes in chunks of 2, up to 4 chunks in flight
+        CommitScheduler scheduler( 2, 4 );
+        int queued = 25;
+
+        // full chunks start while the changes come in
+        int started = 0;
+        while ( int size = scheduler.nextChunkSize( queued, false ) ) {
+            QCOMPARE( size, 2 );
+            queued -= size;
+            scheduler.chunkStarted();
+            ++started;
+        }
+        QCOMPARE( started, 4 );
+        QCOMPARE( scheduler.inFlight(), 4 );
+        QVERIFY( !scheduler.canStart() );
+        QCOMPARE( queued, 17 );
+
+        // flushing at committed_all drains the queue as chunks finish
+        while ( queued > 0 || scheduler.inFlight() > 0 ) {
+            QVERIFY( scheduler.inFlight() <= scheduler.window() );
+            if ( int size = scheduler.nextChunkSize( queued, true ) ) {
+                QVERIFY( size <= scheduler.batchSize() );
+                queued -= size;
+                scheduler.chunkStarted();
+                ++started;
+            } else {
+                scheduler.chunkFinished();
+            }
+        }
+        QCOMPARE( started, 13 );
+        QCOMPARE( queued, 0 );
+    }
+
+    void testWindowSmallerThanBatch()
+    {
+        CommitScheduler scheduler( 200, 1 );
+        QCOMPARE( scheduler.nextChunkSize( 1000, false ), 200 );
+        scheduler.chunkStarted();
+        QCOMPARE( scheduler.nextChunkSize( 800, true ), 0 );
+        scheduler.chunkFinished();
+        QCOMPARE( scheduler.nextChunkSize( 800, true ), 200 );
+    }
+
+    void testLimits()
+    {
+        CommitScheduler scheduler( 0, -1 );
+        QCOMPARE( scheduler.batchSize(), 1 );
+        QCOMPARE( scheduler.window(), 1 );
+        scheduler.setLimits( 50, 8 );
+        QCOMPARE( scheduler.batchSize(), 50 );
+        QCOMPARE( scheduler.window(), 8 );
+    }
+};
+
+QTEST_KDEMAIN_CORE( CommitSchedulerTest )
+
+#include "commitschedulertest.moc"
@@ -0,0 +1,160 @@
+/*
+    Copyright (c) 2026 Emanoil Kotsev <deloptes@yahoo.com>
+
+    $Id$
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+
+#include "conversioncache.h"
+
+#include <KTempDir>
+
+#include <QFileInfo>
+
+#include <qtest_kde.h>
+
+class ConversionCacheTest : public QObject
+{
+    Q_OBJECT
+
+  private slots:
+    void testLookup()
+    {
+        KTempDir dir;
+        ConversionCache cache( dir.name() + "cache", 1024 * 1024, false );
+        cache.insert( 1, 5, "vcard30", "BEGIN:VCARD" );
+
+        QByteArray data;
+        QVERIFY( cache.lookup( 1, 5, "vcard30", &data ) );
+        QCOMPARE( data, QByteArray( "BEGIN:VCARD" ) );
+        QVERIFY( !cache.lookup( 1, 6, "vcard30", &data ) );
+        QVERIFY( !cache.lookup( 1, 5, "vcard21", &data ) );
+        QVERIFY( !cache.lookup( 2, 5, "vcard30", &data ) );
+    }
+
+    void testReplace()
+    {
+        KTempDir dir;
+        ConversionCache cache( dir.name() + "cache", 1024 * 1024, false );
+        cache.insert( 1, 5, "vcard30", "old" );
+        cache.insert( 1, 6, "vcard30", "new" );
+
+        QByteArray data;
+        QVERIFY( !cache.lookup( 1, 5, "vcard30", &data ) );
+        QVERIFY( cache.lookup( 1, 6, "vcard30", &data ) );
+        QCOMPARE( data, QByteArray( "new" ) );
+    }
+
+    void testCompressed()
+    {
+        KTempDir dir;
+        ConversionCache cache( dir.name() + "cache", 1024 * 1024, true );
+        const QByteArray payload = QByteArray( "PHOTO;ENCODING=b:" ) + QByteArray( 10000, 'A' );
+        cache.insert( 1, 1, "vcard30", payload );
+
+        QByteArray data;
+        QVERIFY( cache.lookup( 1, 1, "vcard30", &data ) );
+        QCOMPARE( data, payload );
+        QVERIFY( QFileInfo( dir.name() + "cache" ).size() < payload.size() );
+    }
+
+    void testReload()
+    {
+        KTempDir dir;
+        {
+            ConversionCache cache( dir.name() + "cache", 1024 * 1024, false );
+            cache.insert( 1, 1, "vcard30", "first" );
+            cache.insert( 2, 1, "vcard30", "second" );
+        }
+
+        ConversionCache cache( dir.name() + "cache", 1024 * 1024, false );
+        QByteArray data;
+        QVERIFY( cache.lookup( 2, 1, "vcard30", &data ) );
+        QCOMPARE( data, QByteArray( "second" ) );
+        QVERIFY( cache.lookup( 1, 1, "vcard30", &data ) );
+        QCOMPARE( data, QByteArray( "first" ) );
+    }
+
+    void testTruncatedRecord()
+    {
+        KTempDir dir;
+        {
+            ConversionCache cache( dir.name() + "cache", 1024 * 1024, false );
+            cache.insert( 1, 1, "vcard30", "complete" );
+            cache.insert( 2, 1, "vcard30", QByteArray( 100, 'x' ) );
+        }
+        // an interrupted write
+        QFile file( dir.name() + "cache" );
+        QVERIFY( file.resize( file.size() - 10 ) );
+
+        ConversionCache cache( dir.name() + "cache", 1024 * 1024, false );
+        QByteArray data;
+        QVERIFY( cache.lookup( 1, 1, "vcard30", &data ) );
+        QVERIFY( !cache.lookup( 2, 1, "vcard30", &data ) );
+    }
+
+    void testEviction()
+    {
+        KTempDir dir;
+        const int maxSize = 16 * 1024;
+        ConversionCache cache( dir.name() + "cache", maxSize, false );
+        QByteArray data;
+        for ( int id = 0; id < 200; ++id ) {
+            cache.insert( id, 1, "vcard30", QByteArray( 200, 'a' + id % 26 ) );
+            // an old entry that is still in use
+            if ( id % 20 == 19 )
+                QVERIFY( cache.lookup( 0, 1, "vcard30", &data ) );
+        }
+
+        QVERIFY( QFileInfo( dir.name() + "cache" ).size() <= maxSize );
+        QVERIFY( cache.lookup( 0, 1, "vcard30", &data ) );
+        QCOMPARE( data, QByteArray( 200, 'a' ) );
+        QVERIFY( !cache.lookup( 1, 1, "vcard30", &data ) );
+        QVERIFY( cache.lookup( 199, 1, "vcard30", &data ) );
+        QCOMPARE( data, QByteArray( 200, 'a' + 199 % 26 ) );
+    }
+
+    void testEvictionOrder()
+    {
+        KTempDir dir;
+        const int maxSize = 16 * 1024;
+        QByteArray data;
+        {
+            // about 240 bytes per record, no compaction yet
+            ConversionCache cache( dir.name() + "cache", maxSize, false );
+            for ( int id = 0; id < 60; ++id )
+                cache.insert( id, 1, "vcard30", QByteArray( 200, 'a' + id % 26 ) );
+            // the oldest entry is used again
+            QVERIFY( cache.lookup( 0, 1, "vcard30", &data ) );
+        }
+
+        // the next sync runs in a new process
+        ConversionCache cache( dir.name() + "cache", maxSize, false );
+        for ( int id = 60; id < 80; ++id )
+            cache.insert( id, 1, "vcard30", QByteArray( 200, 'a' + id % 26 ) );
+
+        QVERIFY( cache.lookup( 0, 1, "vcard30", &data ) );
+        QCOMPARE( data, QByteArray( 200, 'a' ) );
+        QVERIFY( !cache.lookup( 1, 1, "vcard30", &data ) );
+        QVERIFY( cache.lookup( 79, 1, "vcard30", &data ) );
+    }
+};
+
+QTEST_KDEMAIN_CORE( ConversionCacheTest )
+
+#include "conversioncachetest.moc"
@@ -0,0 +1,160 @@
+/*
+    Copyright (c) 2026 Emanoil Kotsev <deloptes@yahoo.com>
+
+    $Id$
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+
+#include "payloadserializer.h"
+
+#include <kabc/addressee.h>
+#include <kabc/phonenumber.h>
+#include <kcal/event.h>
+
+#include <qtest_kde.h>
+
+#include <boost/shared_ptr.hpp>
+
+using namespace Akonadi;
+
+typedef boost::shared_ptr<KCal::Incidence> IncidencePtr;
+
+static Item contactItem()
+{
+    KABC::Addressee addressee;
+    addressee.setUid( "payloadserializerbenchmark-contact" );
+    addressee.setNameFromString( "Jane Doe" );
+    addressee.insertEmail( "jane@example.org", true );
+    addressee.insertPhoneNumber( KABC::PhoneNumber( "+49 30 1234567", KABC::PhoneNumber::Work ) );
+    addressee.setOrganization( "Example" );
+
+    Item item( "text/directory" );
+    item.setPayload<KABC::Addressee>( addressee );
+    return item;
+}
+
+static Item eventItem()
+{
+    KCal::Event *event = new KCal::Event;
+    event->setUid( "payloadserializerbenchmark-event" );
+    event->setSummary( "Meeting" );
+    event->setLocation( "Room 1" );
+    event->setDescription( "Weekly status" );
+    event->setDtStart( KDateTime( QDate( 2010, 5, 1 ), QTime( 10, 0 ), KDateTime::UTC ) );
+    event->setDtEnd( KDateTime( QDate( 2010, 5, 1 ), QTime( 11, 0 ), KDateTime::UTC ) );
+
+    Item item( "application/x-vnd.akonadi.calendar.event" );
+    item.setPayload<IncidencePtr>( IncidencePtr( event ) );
+    return item;
+}
+
+/**
+ * Time per item of each conversion path, run with -tickcounter or -callgrind
+ * for numbers that can be compared between builds.
+ */
+class PayloadSerializerBenchmark : public QObject
+{
+    Q_OBJECT
+
+  private:
+    void addPaths()
+    {
+        QTest::addColumn<QString>( "mimeType" );
+        QTest::addColumn<QString>( "objformat" );
+        QTest::addColumn<int>( "path" );
+
+        QTest::newRow( "passthrough vcard30" ) << "text/directory" << "vcard30" << int( PayloadSerializer::Passthrough );
+        QTest::newRow( "passthrough vevent20" ) << "application/x-vnd.akonadi.calendar.event" << "vevent20"
+                                                << int( PayloadSerializer::Passthrough );
+        QTest::newRow( "vcard21" ) << "text/directory" << "vcard21" << int( PayloadSerializer::VCard21 );
+        QTest::newRow( "vcalendar10" ) << "application/x-vnd.akonadi.calendar.event" << "vevent10"
+                                       << int( PayloadSerializer::VCalendar10 );
+    }
+
+  private slots:
+    void benchmarkSerialize_data()
+    {
+        addPaths();
+    }
+
+    void benchmarkSerialize()
+    {
+        QFETCH( QString, mimeType );
+        QFETCH( QString, objformat );
+        QFETCH( int, path );
+
+        PayloadSerializer serializer;
+        serializer.setFormat( mimeType, objformat );
+        QCOMPARE( int( serializer.path() ), path );
+        const Item item = ( mimeType == "text/directory" ) ? contactItem() : eventItem();
+
+        QByteArray data;
+        QBENCHMARK {
+            data = serializer.serialize( item );
+        }
+        QVERIFY( !data.isEmpty() );
+    }
+
+    void benchmarkDeserialize_data()
+    {
+        addPaths();
+    }
+
+    void benchmarkDeserialize()
+    {
+        QFETCH( QString, mimeType );
+        QFETCH( QString, objformat );
+
+        PayloadSerializer serializer;
+        serializer.setFormat( mimeType, objformat );
+        const QByteArray data = serializer.serialize( ( mimeType == "text/directory" ) ? contactItem() : eventItem() );
+        QVERIFY( !data.isEmpty() );
+
+        bool parsed = false;
+        QBENCHMARK {
+            Item item;
+            parsed = serializer.deserialize( &item, data );
+        }
+        QVERIFY( parsed );
+    }
+
+    void benchmarkFingerprint_data()
+    {
+        addPaths();
+    }
+
+    void benchmarkFingerprint()
+    {
+        QFETCH( QString, mimeType );
+        QFETCH( QString, objformat );
+
+        PayloadSerializer serializer;
+        serializer.setFormat( mimeType, objformat );
+        const Item item = ( mimeType == "text/directory" ) ? contactItem() : eventItem();
+
+        QByteArray fingerprint;
+        QBENCHMARK {
+            fingerprint = serializer.fingerprint( item );
+        }
+        QVERIFY( !fingerprint.isEmpty() );
+    }
+};
+
+QTEST_KDEMAIN_CORE( PayloadSerializerBenchmark )
+
+#include "payloadserializerbenchmark.moc"
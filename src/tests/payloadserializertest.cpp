@@ -0,0 +1,234 @@
+/*
+    Copyright (c) 2026 Emanoil Kotsev <deloptes@yahoo.com>
+
+    $Id$
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+
+#include "payloadserializer.h"
+
+#include <kabc/addressee.h>
+#include <kabc/picture.h>
+#include <kcal/event.h>
+
+#include <QFile>
+#include <QImage>
+
+#include <QTest>
+
+#include <qtest_kde.h>
+
+#include <boost/shared_ptr.hpp>
+
+#include <glib.h>
+
+#include <opensync/opensync.h>
+#include <opensync/opensync-data.h>
+#include <opensync/opensync-format.h>
+
+using namespace Akonadi;
+
+typedef boost::shared_ptr<KCal::Incidence> IncidencePtr;
+
+static Item eventItem( const QString &summary )
+{
+    KCal::Event *event = new KCal::Event;
+    event->setUid( "payloadserializertest-event" );
+    event->setSummary( summary );
+    event->setDtStart( KDateTime( QDate( 2010, 5, 1 ), QTime( 10, 0 ), KDateTime::UTC ) );
+    event->setDtEnd( KDateTime( QDate( 2010, 5, 1 ), QTime( 11, 0 ), KDateTime::UTC ) );
+
+    Item item( "application/x-vnd.akonadi.calendar.event" );
+    item.setPayload<IncidencePtr>( IncidencePtr( event ) );
+    return item;
+}
+
+static KABC::Picture picture( int size )
+{
+    QImage image( size, size, QImage::Format_ARGB32 );
+    image.fill( 0xff336699 );
+    return KABC::Picture( image );
+}
+
+// peak resident set size of the process in kB, -1 if unknown
+static int peakMemory()
+{
+    QFile file( "/proc/self/status" );
+    if ( !file.open( QIODevice::ReadOnly ) )
+        return -1;
+    foreach ( const QByteArray &line, file.readAll().split( '\n' ) )
+        if ( line.startsWith( "VmHWM:" ) )
+            return line.mid( 6 ).trimmed().split( ' ' ).first().toInt();
+    return -1;
+}
+
+static Item contactItem( const KABC::Picture &photo )
+{
+    KABC::Addressee addressee;
+    addressee.setUid( "payloadserializertest-contact" );
+    addressee.setNameFromString( "Jane Doe" );
+    addressee.setPhoto( photo );
+
+    Item item( "text/directory" );
+    item.setPayload<KABC::Addressee>( addressee );
+    return item;
+}
+
+class PayloadSerializerTest : public QObject
+{
+    Q_OBJECT
+
+  private slots:
+    void testFingerprintStable()
+    {
+        PayloadSerializer serializer;
+        serializer.setFormat( "application/x-vnd.akonadi.calendar.event", "vevent20" );
+        const Item item = eventItem( "Meeting" );
+
+        const QByteArray first = serializer.fingerprint( item );
+        QVERIFY( !first.isEmpty() );
+        // DTSTAMP is written with the current time, in seconds
+        QTest::qSleep( 1100 );
+        QCOMPARE( serializer.fingerprint( item ), first );
+    }
+
+    void testFingerprintChanges()
+    {
+        PayloadSerializer serializer;
+        serializer.setFormat( "application/x-vnd.akonadi.calendar.event", "vevent20" );
+        QVERIFY( serializer.fingerprint( eventItem( "Meeting" ) ) != serializer.fingerprint( eventItem( "Lunch" ) ) );
+        QVERIFY( serializer.fingerprint( Item( "application/x-vnd.akonadi.calendar.event" ) ).isEmpty() );
+    }
+
+    void testFingerprintPolicy()
+    {
+        const Item item = eventItem( "Meeting" );
+
+        PayloadSerializer passthrough;
+        passthrough.setFormat( "application/x-vnd.akonadi.calendar.event", "vevent20" );
+        PayloadSerializer converted;
+        converted.setFormat( "application/x-vnd.akonadi.calendar.event", "vevent10" );
+        converted.setMaxInlineSize( 1024 );
+
+        QCOMPARE( converted.fingerprint( item ), passthrough.fingerprint( item ) );
+    }
+
+    void testStrippedPhotoRoundTrip()
+    {
+        PayloadSerializer serializer;
+        serializer.setFormat( "text/directory", "vcard21" );
+        serializer.setMaxInlineSize( 1024 );
+
+        const Item stored = contactItem( picture( 64 ) );
+        const QByteArray sent = serializer.serialize( stored );
+        QVERIFY( !sent.isEmpty() );
+        QVERIFY( !sent.contains( "PHOTO" ) );
+
+        // the peer edits the name and sends the contact back
+        Item modified;
+        QVERIFY( serializer.deserialize( &modified, QByteArray( sent ).replace( "Jane", "Joan" ) ) );
+        QVERIFY( modified.payload<KABC::Addressee>().photo().isEmpty() );
+
+        QVERIFY( serializer.restoreLargeBinaries( &modified, stored ) );
+        const KABC::Addressee addressee = modified.payload<KABC::Addressee>();
+        QCOMPARE( addressee.givenName(), QString( "Joan" ) );
+        QVERIFY( addressee.photo() == stored.payload<KABC::Addressee>().photo() );
+    }
+
+    void testRemovedPhoto()
+    {
+        PayloadSerializer serializer;
+        serializer.setFormat( "text/directory", "vcard21" );
+        serializer.setMaxInlineSize( 1024 );
+
+        // small enough to be sent, so the peer removed it
+        const Item stored = contactItem( picture( 4 ) );
+        QVERIFY( serializer.serialize( stored ).contains( "PHOTO" ) );
+        Item modified;
+        QVERIFY( serializer.deserialize( &modified, serializer.serialize( contactItem( KABC::Picture() ) ) ) );
+        QVERIFY( !serializer.restoreLargeBinaries( &modified, stored ) );
+        QVERIFY( modified.payload<KABC::Addressee>().photo().isEmpty() );
+
+        // nothing was left out without a limit
+        serializer.setMaxInlineSize( 0 );
+        QVERIFY( !serializer.restoreLargeBinaries( &modified, contactItem( picture( 64 ) ) ) );
+    }
+
+    void testToOSyncBuffer()
+    {
+        const QByteArray data( "BEGIN:VNOTE\0BODY\0END", 21 );
+        char *buffer = PayloadSerializer::toOSyncBuffer( data );
+        QCOMPARE( QByteArray( buffer, data.size() ), data );
+        QCOMPARE( buffer[data.size()], '\0' );
+        g_free( buffer );
+    }
+
+    void testPeakMemory()
+    {
+        if ( peakMemory() < 0 )
+            QSKIP( "no /proc/self/status", SkipAll );
+
+        PayloadSerializer serializer;
+        serializer.setFormat( "text/directory", "vcard21" );
+
+        // noise does not compress, about 60 kB of PNG per vCard
+        QImage image( 128, 128, QImage::Format_RGB32 );
+        qsrand( 42 );
+        for ( int y = 0; y < image.height(); ++y )
+            for ( int x = 0; x < image.width(); ++x )
+                image.setPixel( x, y, qrand() );
+        const Item item = contactItem( KABC::Picture( image ) );
+
+        OSyncError *oerror = 0;
+        OSyncObjFormat *format = osync_objformat_new( "vcard21", "contact", &oerror );
+        QVERIFY( format );
+
+        // reported the way reportChange() does, the last unref frees the buffer
+        qint64 bytes = 0;
+        const int before = peakMemory();
+        for ( int i = 0; i < 3000; ++i ) {
+            const QByteArray payload = serializer.serialize( item );
+            char *buffer = PayloadSerializer::toOSyncBuffer( payload );
+            OSyncData *odata = osync_data_new( buffer, payload.size(), format, &oerror );
+            QVERIFY( odata );
+            OSyncChange *change = osync_change_new( &oerror );
+            QVERIFY( change );
+            osync_change_set_data( change, odata );
+            osync_data_unref( odata );
+            bytes += payload.size();
+            osync_change_unref( change );
+        }
+        const int growth = peakMemory() - before;
+        osync_objformat_unref( format );
+
+        qDebug() << bytes / 1024 << "kB reported, peak memory grew by" << growth << "kB";
+        QVERIFY( bytes > 100 * 1024 * 1024 );
+        QVERIFY( growth < 16 * 1024 );
+    }
+
+    void testFingerprintData()
+    {
+        QCOMPARE( PayloadSerializer::fingerprint( QByteArray() ).size(), 11 );
+        QCOMPARE( PayloadSerializer::fingerprint( "BEGIN:VCARD" ), PayloadSerializer::fingerprint( "BEGIN:VCARD" ) );
+        QVERIFY( PayloadSerializer::fingerprint( "BEGIN:VCARD" ) != PayloadSerializer::fingerprint( "BEGIN:VCARd" ) );
+    }
+};
+
+QTEST_KDEMAIN_CORE( PayloadSerializerTest )
+
+#include "payloadserializertest.moc"
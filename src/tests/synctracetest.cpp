@@ -0,0 +1,82 @@
+/*
+    Copyright (c) 2026 Emanoil Kotsev <deloptes@yahoo.com>
+
+    $Id$
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+
+#include "synctrace.h"
+
+#include <KTempDir>
+
+#include <QFile>
+
+#include <qtest_kde.h>
+
+class SyncTraceTest : public QObject
+{
+    Q_OBJECT
+
+  private slots:
+    void testDecode()
+    {
+        SyncTrace::record( SyncTrace::ChangeReported, 42, 1 );
+        SyncTrace::record( SyncTrace::DeletedReported, 7, 0 );
+
+        const QStringList lines = SyncTrace::decode();
+        QVERIFY( lines.count() >= 2 );
+        QVERIFY( lines.at( lines.count() - 2 ).endsWith( "item 42 reported, changetype 1" ) );
+        QVERIFY( lines.last().endsWith( "7 items reported deleted" ) );
+    }
+
+    void testMacro()
+    {
+        SYNC_TRACE( 1, ChunkStarted, 200, 3 );
+        QVERIFY( SyncTrace::decode().last().endsWith( "chunk of 200 changes started, 3 in flight" ) );
+    }
+
+    void testWrap()
+    {
+        for ( int i = 0; i < 3 * 8192 + 5; ++i )
+            SyncTrace::record( SyncTrace::UnmodifiedSkipped, i, 1 );
+
+        // only the most recent events are kept, oldest first
+        const QStringList lines = SyncTrace::decode();
+        QCOMPARE( lines.count(), 8192 );
+        QVERIFY( lines.first().endsWith( QString( "item %1 unmodified, revision 1" ).arg( 2 * 8192 + 5 ) ) );
+        QVERIFY( lines.last().endsWith( QString( "item %1 unmodified, revision 1" ).arg( 3 * 8192 + 4 ) ) );
+    }
+
+    void testDump()
+    {
+        KTempDir dir;
+        SyncTrace::setDumpFile( dir.name() + "trace.txt" );
+        SyncTrace::record( SyncTrace::GetChangesStarted, 1, 0 );
+        SyncTrace::dump();
+
+        QFile file( dir.name() + "trace.txt" );
+        QVERIFY( file.open( QIODevice::ReadOnly ) );
+        const QList<QByteArray> lines = file.readAll().trimmed().split( '\n' );
+        QCOMPARE( lines.count(), SyncTrace::decode().count() );
+        QVERIFY( lines.last().endsWith( "getChanges started, slow sync 1" ) );
+    }
+};
+
+QTEST_KDEMAIN_CORE( SyncTraceTest )
+
+#include "synctracetest.moc"
@@ -0,0 +1,122 @@
+/*
+    Copyright (c) 2026 Emanoil Kotsev <deloptes@yahoo.com>
+
+    $Id$
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+
+#include "timeoutbudget.h"
+
+#include <KTempDir>
+
+#include <qtest_kde.h>
+
+class TimeoutBudgetTest : public QObject
+{
+    Q_OBJECT
+
+  private slots:
+    void testDefaults()
+    {
+        KTempDir dir;
+        TimeoutBudget budget( dir.name() + "timeouts.ini" );
+        // the fixed cost of a callback with the safety factor
+        QCOMPARE( budget.timeout( SyncMetrics::Connect ), 20 );
+        QCOMPARE( budget.timeout( SyncMetrics::GetChanges ), 20 );
+    }
+
+    void testExpectItems()
+    {
+        KTempDir dir;
+        TimeoutBudget budget( dir.name() + "timeouts.ini" );
+        budget.expectItems( SyncMetrics::GetChanges, 100000 );
+        // 2 ms per item until measured
+        QCOMPARE( budget.timeout( SyncMetrics::GetChanges ), ( 5000 + 200000 ) * 4 / 1000 );
+    }
+
+    void testBounds()
+    {
+        KTempDir dir;
+        TimeoutBudget budget( dir.name() + "timeouts.ini" );
+        budget.expectItems( SyncMetrics::GetChanges, 100000000 );
+        QCOMPARE( budget.timeout( SyncMetrics::GetChanges ), 3600 );
+
+        budget.observe( SyncMetrics::Disconnect, 0, 1 );
+        QCOMPARE( budget.timeout( SyncMetrics::Disconnect ), 20 );
+    }
+
+    void testObserve()
+    {
+        KTempDir dir;
+        TimeoutBudget budget( dir.name() + "timeouts.ini" );
+
+        // slower than assumed, taken at once
+        QVERIFY( budget.observe( SyncMetrics::Commit, 5000 + 10 * 1000, 10 ) );
+        QCOMPARE( budget.timeout( SyncMetrics::Commit ), ( 5000 + 10 * 1000 ) * 4 / 1000 );
+
+        // faster, only eases the budget down
+        budget.observe( SyncMetrics::Commit, 5000, 10 );
+        QCOMPARE( budget.timeout( SyncMetrics::Commit ), ( 5000 + 10 * 800 ) * 4 / 1000 );
+    }
+
+    void testCommitAll()
+    {
+        KTempDir dir;
+        TimeoutBudget budget( dir.name() + "timeouts.ini" );
+        QCOMPARE( budget.timeout( SyncMetrics::CommitAll ), 3600 );
+
+        // a quiet sync must not shrink the budget of the next large import
+        budget.observe( SyncMetrics::CommitAll, 0, 1 );
+        QCOMPARE( budget.timeout( SyncMetrics::CommitAll ), 3600 );
+    }
+
+    void testOverrun()
+    {
+        KTempDir dir;
+        const QString fileName = dir.name() + "timeouts.ini";
+        {
+            TimeoutBudget budget( fileName );
+            const int timeout = budget.timeout( SyncMetrics::GetChanges );
+            QVERIFY( !budget.observe( SyncMetrics::GetChanges, timeout * 1000 + 1, 1000 ) );
+        }
+
+        // saved right away, the sync most likely failed before sync_done
+        TimeoutBudget budget( fileName );
+        QVERIFY( budget.timeout( SyncMetrics::GetChanges ) > 20 );
+    }
+
+    void testSave()
+    {
+        KTempDir dir;
+        const QString fileName = dir.name() + "timeouts.ini";
+        int timeout;
+        {
+            TimeoutBudget budget( fileName );
+            budget.observe( SyncMetrics::Commit, 5000 + 200 * 50, 200 );
+            timeout = budget.timeout( SyncMetrics::Commit );
+            budget.save();
+        }
+
+        TimeoutBudget budget( fileName );
+        QCOMPARE( budget.timeout( SyncMetrics::Commit ), timeout );
+    }
+};
+
+QTEST_KDEMAIN_CORE( TimeoutBudgetTest )
+
+#include "timeoutbudgettest.moc"
@@ -0,0 +1,103 @@
+/*
+    Copyright (c) 2026 Emanoil Kotsev <deloptes@yahoo.com>
+
+    $Id$
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#include "timeoutbudget.h"
+
+#include <KDebug>
+
+#include <QSettings>
+
+#include <opensync/opensync.h>
+
+// the fixed timeout used before, also the lower bound
+static const int MinTimeout = 15;
+// a hang is reported after an hour at the latest
+static const int MaxTimeout = 60 * 60;
+// fixed cost of a callback, and the factor between expected time and timeout
+static const int BaseMsecs = 5000;
+static const int SafetyFactor = 4;
+
+static const char *phaseKeys[SyncMetrics::PhaseCount] = {
+    "connect", "disconnect", "get_changes", "commit", "committed_all", "sync_done"
+};
+
+// assumed until the first sync has been measured
+static const double defaultMsecsPerItem[SyncMetrics::PhaseCount] = { 0, 0, 2, 100, 20, 0 };
+
+TimeoutBudget::TimeoutBudget( const QString &fileName ) :
+        m_FileName( fileName )
+{
+    QSettings settings( m_FileName, QSettings::IniFormat );
+    for ( int i = 0; i < SyncMetrics::PhaseCount; ++i ) {
+        settings.beginGroup( phaseKeys[i] );
+        m_MsecsPerItem[i] = settings.value( "msecsPerItem", defaultMsecsPerItem[i] ).toDouble();
+        m_Items[i] = settings.value( "items", 1 ).toInt();
+        settings.endGroup();
+    }
+}
+
+int TimeoutBudget::timeout( SyncMetrics::Phase phase ) const
+{
+    // writes all changes of the peer, and how many there are is only known
+    // once the timeouts have been handed to OpenSync
+    if ( phase == SyncMetrics::CommitAll )
+        return MaxTimeout;
+
+    const double expected = BaseMsecs + m_Items[phase] * m_MsecsPerItem[phase];
+    return qBound( MinTimeout, int( expected * SafetyFactor / 1000 ), MaxTimeout );
+}
+
+void TimeoutBudget::expectItems( SyncMetrics::Phase phase, int items )
+{
+    m_Items[phase] = qMax( items, 1 );
+}
+
+bool TimeoutBudget::observe( SyncMetrics::Phase phase, int msecs, int items )
+{
+    const bool inTime = ( msecs <= timeout( phase ) * 1000 );
+    const double perItem = double( qMax( msecs - BaseMsecs, 0 ) ) / qMax( items, 1 );
+
+    // slower syncs count at once, faster ones only slowly lower the budget
+    if ( perItem > m_MsecsPerItem[phase] )
+        m_MsecsPerItem[phase] = perItem;
+    else
+        m_MsecsPerItem[phase] = 0.8 * m_MsecsPerItem[phase] + 0.2 * perItem;
+    m_Items[phase] = qMax( items, 1 );
+
+    if ( !inTime ) {
+        kDebug() << phaseKeys[phase] << "took" << msecs << "ms for" << items << "items, longer than its timeout";
+        osync_trace( TRACE_ERROR, "%s took %d ms for %d items, longer than its timeout", phaseKeys[phase], msecs, items );
+        // the sync has most likely failed, make sure the next one knows
+        save();
+    }
+    return inTime;
+}
+
+void TimeoutBudget::save() const
+{
+    QSettings settings( m_FileName, QSettings::IniFormat );
+    for ( int i = 0; i < SyncMetrics::PhaseCount; ++i ) {
+        settings.beginGroup( phaseKeys[i] );
+        settings.setValue( "msecsPerItem", m_MsecsPerItem[i] );
+        settings.setValue( "items", m_Items[i] );
+        settings.endGroup();
+    }
+}
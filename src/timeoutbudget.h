@@ -0,0 +1,68 @@
+/*
+    Copyright (c) 2026 Emanoil Kotsev <deloptes@yahoo.com>
+
+    $Id$
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#ifndef TIMEOUTBUDGET_H
+#define TIMEOUTBUDGET_H
+
+#include "syncmetrics.h"
+
+#include <QString>
+
+/**
+ * Timeouts of a sink's callbacks, budgeted from the throughput measured in
+ * earlier syncs and the number of items expected in this one.
+ *
+ * OpenSync takes the timeouts when the sink is set up, so they can not grow
+ * during a sync. Instead a callback that overran its budget is reported and
+ * raises the budget of the next sync right away.
+ */
+class TimeoutBudget
+{
+  public:
+    explicit TimeoutBudget( const QString &fileName );
+
+    /**
+     * Returns the timeout of the phase in seconds. committed_all always gets
+     * the upper bound, its work depends on the changes the peer sends.
+     */
+    int timeout( SyncMetrics::Phase phase ) const;
+
+    /**
+     * Sets the number of items expected in the phase, e.g. the size of the collections.
+     */
+    void expectItems( SyncMetrics::Phase phase, int items );
+
+    /**
+     * Records how long the phase took for the given number of items.
+     * Returns false if it took longer than its timeout.
+     */
+    bool observe( SyncMetrics::Phase phase, int msecs, int items );
+
+    void save() const;
+
+  private:
+    QString m_FileName;
+    // measured time per item, and the items of the last sync
+    double m_MsecsPerItem[SyncMetrics::PhaseCount];
+    int m_Items[SyncMetrics::PhaseCount];
+};
+
+#endif